@@ -0,0 +1,1001 @@
+// Host microbenchmarks for ConfigManager.
+//
+// Build and run with `make bench`. Each case reports the mean time per
+// operation, heap allocations per operation and the peak heap above the
+// baseline measured while the case runs.
+
+#include <ConfigManager.h>
+#include <ConfigSchema.h>
+#include <LittleFS.h>
+#include <nvs.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "ConfigAssets.h"
+#include "host/HostHeap.h"
+#include "host/HostStorage.h"
+
+// Every case runs for at least this long and this many iterations.
+static const unsigned long BENCH_MIN_MICROS = 200000;
+static const unsigned long BENCH_MIN_ITERATIONS = 10;
+
+static const char* benchFilter = NULL;
+
+/**
+ * Bench Result
+ */
+struct BenchResult {
+  double nsPerOp;
+  double allocsPerOp;
+  size_t peakHeap;
+};
+
+template <typename F>
+BenchResult measure(F fn) {
+  // Warm up, so lazily allocated state does not count against the case.
+  fn();
+
+  HostHeap before = hostHeapMark();
+  unsigned long iterations = 0;
+  unsigned long elapsed = 0;
+
+  // The host delay() advances micros() without sleeping, so wall time is
+  // taken from the monotonic clock directly.
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  while (iterations < BENCH_MIN_ITERATIONS || elapsed < BENCH_MIN_MICROS) {
+    fn();
+    iterations++;
+    elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - t0)
+                  .count();
+  }
+
+  BenchResult res;
+  res.nsPerOp = (double)elapsed * 1000.0 / iterations;
+  res.allocsPerOp =
+      (double)(hostHeap.allocations - before.allocations) / iterations;
+  res.peakHeap = hostHeap.peak > before.inUse ? hostHeap.peak - before.inUse
+                                              : 0;
+  return res;
+}
+
+static void report(const char* name, size_t params, const BenchResult& res) {
+  printf("%-28s %6zu %14.0f %12.1f %12zu\n", name, params, res.nsPerOp,
+         res.allocsPerOp, res.peakHeap);
+}
+
+static void reportSize(const char* name, size_t params, size_t bytes) {
+  if (benchFilter == NULL || strstr(name, benchFilter) != NULL) {
+    printf("%-28s %6zu %14zu bytes\n", name, params, bytes);
+  }
+}
+
+static bool enabled(const char* name) {
+  return benchFilter == NULL || strstr(name, benchFilter) != NULL;
+}
+
+#define BENCH(name, params, body)              \
+  do {                                         \
+    if (enabled(name)) {                       \
+      report(name, params, measure([&]() body)); \
+    }                                          \
+  } while (0)
+
+/**
+ * Bench Config
+ *
+ * N parameters split evenly between int, float, bool and string fields.
+ */
+template <size_t N>
+struct BenchConfig {
+  int32_t ints[N / 4 + 1];
+  float floats[N / 4 + 1];
+  bool bools[N / 4 + 1];
+  char strings[N / 4 + 1][16];
+};
+
+static char paramNames[1000][8];
+
+static void seedStorage() {
+  EEPROM.reset();
+  EEPROM.begin(CONFIG_OFFSET);
+  const char magic[MAGIC_LENGTH] = {'C', 'M'};
+  char ssid[SSID_LENGTH] = "bench";
+  char password[PASSWORD_LENGTH] = "password";
+  EEPROM.put(0, magic);
+  EEPROM.put(MAGIC_LENGTH, ssid);
+  EEPROM.put(MAGIC_LENGTH + SSID_LENGTH, password);
+  EEPROM.commit();
+}
+
+// Seeds a flash backend like seedStorage() does the EEPROM, for configs the
+// EEPROM cannot hold.
+static void seedStorage(ConfigStorage& storage) {
+  const char magic[MAGIC_LENGTH] = {'C', 'M'};
+  char ssid[SSID_LENGTH] = "bench";
+  char password[PASSWORD_LENGTH] = "password";
+  storage.begin(CONFIG_OFFSET);
+  storage.write(0, magic, MAGIC_LENGTH);
+  storage.write(MAGIC_LENGTH, ssid, SSID_LENGTH);
+  storage.write(MAGIC_LENGTH + SSID_LENGTH, password, PASSWORD_LENGTH);
+  StorageRange range = {0, CONFIG_OFFSET};
+  storage.commit(&range, 1);
+}
+
+// Whether the image of a config this large fits the ESP8266 EEPROM.
+static bool fitsEEPROM(size_t configSize) {
+  return CONFIG_OFFSET + configSize + GENERATION_LENGTH <= SPI_FLASH_SEC_SIZE;
+}
+
+// Sectors per slot for a config this large, with room for the slot header.
+static uint16_t slotSectors(size_t configSize) {
+  return (CONFIG_OFFSET + configSize + GENERATION_LENGTH + 64) /
+             SPI_FLASH_SEC_SIZE +
+         1;
+}
+
+static void seedNetworks(size_t count) {
+  WiFi.networks.clear();
+  for (size_t i = 0; i < count; i++) {
+    HostNetwork net;
+    char ssid[33];
+    snprintf(ssid, sizeof(ssid), "network-%zu", i % (count / 2 + 1));
+    net.ssid = ssid;
+    net.rssi = -30 - (int32_t)(i % 60);
+    net.encryption = i % 3 == 0 ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA2_PSK;
+    memset(net.bssid, (int)i, sizeof(net.bssid));
+    net.channel = 1 + (int32_t)(i % 11);
+    WiFi.networks.push_back(net);
+  }
+}
+
+template <size_t N>
+static void addParameters(ConfigManager& cm, BenchConfig<N>& config) {
+  for (size_t i = 0; i < N; i++) {
+    const char* name = paramNames[i];
+    size_t idx = i / 4;
+    switch (i % 4) {
+      case 0:
+        config.ints[idx] = (int32_t)i;
+        cm.addParameter(name, &config.ints[idx]);
+        break;
+      case 1:
+        config.floats[idx] = (float)i / 2;
+        cm.addParameter(name, &config.floats[idx]);
+        break;
+      case 2:
+        config.bools[idx] = true;
+        cm.addParameter(name, &config.bools[idx]);
+        break;
+      default:
+        snprintf(config.strings[idx], sizeof(config.strings[idx]), "value-%zu",
+                 i);
+        cm.addParameter(name, config.strings[idx], sizeof(config.strings[idx]));
+        break;
+    }
+  }
+}
+
+template <size_t N>
+static std::string putBody(size_t fields) {
+  std::string body = "{";
+  for (size_t i = 0; i < fields && i < N; i++) {
+    char field[48];
+    switch (i % 4) {
+      case 0:
+        snprintf(field, sizeof(field), "\"%s\":%zu", paramNames[i], i + 1);
+        break;
+      case 1:
+        snprintf(field, sizeof(field), "\"%s\":%zu.25", paramNames[i], i);
+        break;
+      case 2:
+        snprintf(field, sizeof(field), "\"%s\":false", paramNames[i]);
+        break;
+      default:
+        snprintf(field, sizeof(field), "\"%s\":\"updated-%zu\"",
+                 paramNames[i], i);
+        break;
+    }
+    if (i > 0) {
+      body += ",";
+    }
+    body += field;
+  }
+  return body + "}";
+}
+
+template <size_t N>
+static void runSuite() {
+  static BenchConfig<N> config;
+  memset(&config, 0, sizeof(config));
+
+  WebServer* server = NULL;
+  ConfigManager* cm = new ConfigManager();
+  cm->setAPICallback([&server](WebServer* s) { server = s; });
+  cm->setMaxParameters(N);
+  addParameters<N>(*cm, config);
+
+  ParameterFootprint footprint = cm->getParameterFootprint();
+  printf("%-28s %6zu %14zu %12s %12zu\n", "registry bytes/param", N,
+         footprint.bytesPerParameter, "-", footprint.totalBytes);
+
+  // The ESP8266 EEPROM holds a single sector. Larger configs are kept in
+  // slots instead, and the cases that go to storage say so.
+  bool eeprom = fitsEEPROM(sizeof(config));
+  const char* on = eeprom ? "" : " (in slots)";
+  char names[4][40];
+  snprintf(names[0], sizeof(names[0]), "begin%s", on);
+  snprintf(names[1], sizeof(names[1]), "save%s", on);
+  snprintf(names[2], sizeof(names[2]), "save_unchanged%s", on);
+  snprintf(names[3], sizeof(names[3]), "save_unchanged (observed%s)",
+           eeprom ? "" : ", in slots");
+  if (!eeprom) {
+    SlotStorage* slots = new SlotStorage(400, slotSectors(sizeof(config)));
+    seedStorage(*slots);
+    cm->setStorage(slots);
+  }
+
+  seedStorage();
+  seedNetworks(N);
+  WiFi.available = true;
+  WiFi.connected = false;
+
+  // The routes below need the server even when a filter skips "begin".
+  cm->begin(config);
+  BENCH(names[0], N, {
+    WiFi.connected = false;
+    cm->begin(config);
+  });
+
+  BENCH("asJson", N, { cm->asJson(); });
+
+  std::string all = putBody<N>(N);
+  DynamicJsonDocument doc(all.size() * 2 + 1024);
+  deserializeJson(doc, all.c_str());
+  BENCH("updateFromJson", N, { cm->updateFromJson(doc.as<JsonObject>()); });
+
+  BENCH(names[1], N, {
+    config.ints[0]++;
+    cm->save();
+  });
+  BENCH(names[2], N, { cm->save(); });
+
+  // The journal holds the whole image in a single sector.
+  if (CONFIG_OFFSET + sizeof(config) < 4000) {
+    // A counter kept in its own region next to the config.
+    struct {
+      uint32_t boots;
+    } counter = {0};
+
+    JournalStorage journal(256, 4);
+    ConfigManager* jm = new ConfigManager();
+    jm->setStorage(&journal);
+    jm->addRegion("counter", counter);
+    seedStorage();
+    jm->begin(config);
+
+    unsigned long written = ESP.flashBytesWritten;
+    unsigned long saves = 0;
+    BENCH("save (journal)", N, {
+      config.ints[0]++;
+      jm->save();
+      saves++;
+    });
+    reportSize("save (journal) flash/op", N,
+               (ESP.flashBytesWritten - written) / (saves ? saves : 1));
+
+    written = ESP.flashBytesWritten;
+    saves = 0;
+    BENCH("saveRegion (journal)", N, {
+      counter.boots++;
+      jm->saveRegion("counter");
+      saves++;
+    });
+    reportSize("saveRegion (journal) flash/op", N,
+               (ESP.flashBytesWritten - written) / (saves ? saves : 1));
+    seedStorage();
+  }
+
+  // Every save rewrites the inactive slot, boot only checks two headers.
+  // Configs beyond the EEPROM already ran the cases above in slots.
+  if (eeprom) {
+    SlotStorage slots(512);
+    ConfigManager* sm = new ConfigManager();
+    sm->setStorage(&slots);
+    seedStorage();
+    sm->begin(config);
+
+    BENCH("save (slots)", N, {
+      config.ints[0]++;
+      sm->save();
+    });
+    BENCH("begin (slots)", N,
+          { slots.begin(CONFIG_OFFSET + sizeof(config)); });
+    seedStorage();
+  }
+
+  // A max age of zero rescans on every call.
+  cm->setScanMaxAge(0);
+  BENCH("scanNetworks", N, { cm->scanNetworks(); });
+  cm->setScanMaxAge(30);
+  BENCH("scanNetworks (cached)", N, { cm->scanNetworks(); });
+  BENCH("GET /scan (cached)", N, { server->request(HTTP_GET, "/scan"); });
+  if (enabled("GET /scan size")) {
+    reportSize("GET /scan size", N,
+               server->request(HTTP_GET, "/scan").body.size());
+  }
+
+  BENCH("GET /settings", N,
+        { server->request(HTTP_GET, "/settings"); });
+
+  std::vector<std::pair<String, String>> acceptMsgPack;
+  acceptMsgPack.push_back(
+      std::make_pair(String("Accept"), String(mimeMsgPack)));
+  BENCH("GET /settings (msgpack)", N, {
+    server->request(HTTP_GET, "/settings", NULL, acceptMsgPack);
+  });
+  if (enabled("GET /settings size (json)")) {
+    reportSize("GET /settings size (json)", N,
+               server->request(HTTP_GET, "/settings").body.size());
+  }
+  if (enabled("GET /settings size (msgpack)")) {
+    reportSize("GET /settings size (msgpack)", N,
+               server->request(HTTP_GET, "/settings", NULL, acceptMsgPack)
+                   .body.size());
+  }
+
+  std::string packed(measureMsgPack(doc), '\0');
+  serializeMsgPack(doc, &packed[0], packed.size());
+  std::vector<std::pair<String, String>> contentMsgPack;
+  contentMsgPack.push_back(
+      std::make_pair(String("Content-Type"), String(mimeMsgPack)));
+
+  std::string one = putBody<N>(1);
+  BENCH("PUT /settings (1 field)", N, {
+    server->request(HTTP_PUT, "/settings", one.c_str(), mimeJSON);
+  });
+  BENCH("PUT /settings (all)", N, {
+    server->request(HTTP_PUT, "/settings", all.c_str(), mimeJSON);
+  });
+  // Keys that match no parameter are dropped while parsing.
+  std::string unknown = "{";
+  for (size_t i = 0; i < 32; i++) {
+    char field[24];
+    snprintf(field, sizeof(field), "%s\"unknown%zu\":%zu", i ? "," : "", i,
+             i);
+    unknown += field;
+  }
+  unknown += "}";
+  BENCH("PUT /settings (unknown keys)", N, {
+    server->request(HTTP_PUT, "/settings", unknown.c_str(), mimeJSON);
+  });
+  BENCH("PUT /settings (msgpack, all)", N, {
+    server->request(HTTP_PUT, "/settings", packed, contentMsgPack);
+  });
+  reportSize("PUT /settings size (json)", N, all.size());
+  reportSize("PUT /settings size (msgpack)", N, packed.size());
+
+  // Observers make save() diff the struct against the stored image.
+  size_t notified = 0;
+  cm->addChangeObserver(paramNames[0], [&notified](const char*) {
+    notified++;
+  });
+  cm->setChangeCallback([&notified](ParameterChanges) { notified++; });
+  BENCH(names[3], N, { cm->save(); });
+  BENCH("PUT /settings (1 field, observed)", N, {
+    server->request(HTTP_PUT, "/settings", one.c_str(), mimeJSON);
+  });
+}
+
+/**
+ * Null Print, discards output.
+ */
+class NullPrint : public Print {
+ public:
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t*, size_t size) { return size; }
+};
+
+struct SchemaConfig {
+  char name[20];
+  bool enabled;
+  int8_t hour;
+  int32_t interval;
+  float ratio;
+  char host[32];
+  uint16_t port;
+  bool verbose;
+};
+
+CONFIG_FIELD(SchemaConfig, name, both);
+CONFIG_FIELD(SchemaConfig, enabled, both);
+CONFIG_FIELD_RANGE(SchemaConfig, hour, both, 0, 23, 6);
+CONFIG_FIELD(SchemaConfig, interval, both);
+CONFIG_FIELD(SchemaConfig, ratio, both);
+CONFIG_FIELD(SchemaConfig, host, both);
+CONFIG_FIELD(SchemaConfig, port, both);
+CONFIG_FIELD(SchemaConfig, verbose, get);
+
+typedef ConfigSchema<SchemaConfig,
+                     SchemaConfig_name,
+                     SchemaConfig_enabled,
+                     SchemaConfig_hour,
+                     SchemaConfig_interval,
+                     SchemaConfig_ratio,
+                     SchemaConfig_host,
+                     SchemaConfig_port,
+                     SchemaConfig_verbose>
+    BenchSchema;
+
+static void runSchemaSuite() {
+  static SchemaConfig config;
+  const size_t fields = 8;
+  NullPrint out;
+
+  ConfigManager* params = new ConfigManager();
+  params->addParameter("name", config.name, sizeof(config.name));
+  params->addParameter("enabled", &config.enabled);
+  params->addParameter("hour", &config.hour);
+  params->addParameter("interval", &config.interval);
+  params->addParameter("ratio", &config.ratio);
+  params->addParameter("host", config.host, sizeof(config.host));
+  params->addParameter("port", &config.port);
+  params->addParameter("verbose", &config.verbose, get);
+  seedStorage();
+  params->begin(config);
+
+  ConfigManager* schema = new ConfigManager();
+  seedStorage();
+  schema->begin<BenchSchema>(config);
+
+  const char* body =
+      "{\"name\":\"bench\",\"hour\":7,\"ratio\":1.5,\"port\":8080}";
+  DynamicJsonDocument doc(256);
+  deserializeJson(doc, body);
+
+  BENCH("printJson (parameters)", fields, { params->printJson(out); });
+  BENCH("printJson (schema)", fields, { schema->printJson(out); });
+  BENCH("updateFromJson (parameters)", fields, {
+    params->updateFromJson(doc.as<JsonObject>());
+  });
+  BENCH("updateFromJson (schema)", fields, {
+    schema->updateFromJson(doc.as<JsonObject>());
+  });
+}
+
+// Mean time to first byte of a request, over enough runs to be stable.
+static void reportFirstByte(const char* name,
+                            WebServer* server,
+                            const char* uri,
+                            const std::vector<std::pair<String, String>>& hdrs) {
+  if (!enabled(name)) {
+    return;
+  }
+
+  const unsigned long runs = 2000;
+  unsigned long long total = 0;
+  for (unsigned long i = 0; i < runs; i++) {
+    total += server->request(HTTP_GET, uri, NULL, hdrs).firstByteNanos;
+  }
+  printf("%-28s %6s %14llu ns to first byte\n", name, "-", total / runs);
+}
+
+static void runAssetSuite() {
+  struct {
+    int value;
+  } config = {0};
+
+  // The filesystem holds the same files as the embedded table.
+  SPIFFS.files.clear();
+  for (size_t i = 0; i < configAssetCount; i++) {
+    std::string path(configAssets[i].path);
+    SPIFFS.files[configAssets[i].gzip ? path + ".gz" : path] = std::string(
+        (const char*)configAssets[i].data, configAssets[i].length);
+  }
+
+  WebServer* server = NULL;
+  ConfigManager* cm = new ConfigManager();
+  cm->setAPICallback([&server](WebServer* s) { server = s; });
+  seedStorage();
+  WiFi.available = true;
+  WiFi.connected = false;
+  cm->begin(config);
+
+  std::vector<std::pair<String, String>> plain;
+  std::vector<std::pair<String, String>> gzip;
+  gzip.push_back(std::make_pair(String("Accept-Encoding"), String("gzip")));
+  std::vector<std::pair<String, String>> cached = gzip;
+  cached.push_back(std::make_pair(String("If-None-Match"), String()));
+
+  for (int embedded = 0; embedded < 2; embedded++) {
+    const char* source = embedded ? "progmem" : "spiffs";
+    if (embedded) {
+      cm->setAssets(configAssets, configAssetCount);
+    }
+
+    // Filesystem ETags differ from the embedded ones, ask for the right one.
+    const WebServer::Response& res = server->request(HTTP_GET, "/", NULL, gzip);
+    for (size_t i = 0; i < res.headers.size(); i++) {
+      if (res.headers[i].first == "ETag") {
+        cached.back().second = res.headers[i].second;
+      }
+    }
+
+    char name[3][40];
+    snprintf(name[0], sizeof(name[0]), "GET / (%s)", source);
+    snprintf(name[1], sizeof(name[1]), "GET / (%s, gzip)", source);
+    snprintf(name[2], sizeof(name[2]), "GET / (%s, 304)", source);
+
+    BENCH(name[0], 0, { server->request(HTTP_GET, "/", NULL, plain); });
+    BENCH(name[1], 0, { server->request(HTTP_GET, "/", NULL, gzip); });
+    BENCH(name[2], 0, { server->request(HTTP_GET, "/", NULL, cached); });
+    reportFirstByte(name[0], server, "/", plain);
+    reportFirstByte(name[1], server, "/", gzip);
+    reportFirstByte(name[2], server, "/", cached);
+  }
+
+  // The scheduler runs every built-in task, none with anything to do.
+  BENCH("loop (idle)", 0, { cm->loop(); });
+
+  reportSize("GET / size", 0, server->request(HTTP_GET, "/", NULL, plain)
+                                  .body.size());
+  reportSize("GET / size (gzip)", 0,
+             server->request(HTTP_GET, "/", NULL, gzip).body.size());
+  if (enabled("SPIFFS mounts")) {
+    printf("%-28s %6s %14lu\n", "SPIFFS mounts", "-", SPIFFS.mounts);
+  }
+}
+
+// Captive portal clients probing for connectivity, answered with the
+// prepared redirect.
+static void runPortalSuite() {
+  struct {
+    int value;
+  } config = {0};
+
+  // Nothing stored, so begin() starts the access point.
+  EEPROM.reset();
+  WebServer* server = NULL;
+  ConfigManager* cm = new ConfigManager();
+  cm->setAPCallback([&server](WebServer* s) { server = s; });
+  cm->begin(config);
+
+  server->setHost("connectivitycheck.gstatic.com");
+  BENCH("GET /generate_204 (portal)", 0,
+        { server->request(HTTP_GET, "/generate_204"); });
+  BENCH("GET /unknown (portal)", 0,
+        { server->request(HTTP_GET, "/unknown"); });
+  server->request(HTTP_GET, "/generate_204");
+  reportSize("portal redirect size", 0, server->client().bytesWritten);
+  server->setHost("192.168.1.1");
+}
+
+// A burst of DNS queries from clients joining the access point, drained
+// one per loop and in batches.
+static void runDNSSuite() {
+  struct {
+    int value;
+  } config = {0};
+
+  // connectivitycheck.gstatic.com, type A, class IN.
+  static const uint8_t query[] = {
+      0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      17,   'c',  'o',  'n',  'n',  'e',  'c',  't',  'i',  'v',  'i',  't',
+      'y',  'c',  'h',  'e',  'c',  'k',  7,    'g',  's',  't',  'a',  't',
+      'i',  'c',  3,    'c',  'o',  'm',  0,    0x00, 0x01, 0x00, 0x01};
+  const size_t burst = 8;
+
+  for (size_t batch = 1; batch <= burst; batch *= burst) {
+    EEPROM.reset();
+    ConfigManager* cm = new ConfigManager();
+    cm->setDNSBatch(batch);
+    cm->begin(config);
+
+    char name[40];
+    snprintf(name, sizeof(name), "dns x%zu (%s)", burst,
+             batch == 1 ? "single" : "batched");
+    size_t loops = 0;
+    BENCH(name, 0, {
+      for (size_t i = 0; i < burst; i++) {
+        WiFiUDP::inject(query, sizeof(query));
+      }
+      while (WiFiUDP::queued() > 0) {
+        cm->loop();
+        loops++;
+      }
+    });
+    DNSStats stats = cm->getDNSStats();
+    if (enabled(name)) {
+      printf("%-28s %6s %14.1f loops/burst, %u answered, %u dropped\n", name,
+             "-", (double)loops * burst / (stats.answered + stats.dropped),
+             stats.answered, stats.dropped);
+    }
+  }
+}
+
+// Per request cost of the metrics, the same request with them off and on.
+static void runMetricsSuite() {
+  struct {
+    int value;
+  } config = {0};
+
+  WebServer* server = NULL;
+  for (int on = 0; on < 2; on++) {
+    ConfigManager* cm = new ConfigManager();
+    cm->setAPICallback([&server](WebServer* s) { server = s; });
+    cm->setMetricsEnabled(on);
+    seedStorage();
+    WiFi.available = true;
+    WiFi.connected = false;
+    cm->begin(config);
+
+    BENCH(on ? "GET /settings (metrics)" : "GET /settings (no metrics)", 0,
+          { server->request(HTTP_GET, "/settings"); });
+  }
+
+  BENCH("GET /metrics", 0, { server->request(HTTP_GET, "/metrics"); });
+  reportSize("GET /metrics size", 0,
+             server->request(HTTP_GET, "/metrics").body.size());
+}
+
+/**
+ * Load Client
+ *
+ * Sends GET /settings over and over, on one kept alive connection or a
+ * new one per request. A slow client sends its requests a byte per loop.
+ */
+struct LoadClient {
+  std::shared_ptr<HostSocket> socket;
+  bool keepAlive;
+  bool slow;
+  const char* request;
+  size_t sent;
+  unsigned long served;
+
+  void start() {
+    if (!socket || socket->serverClosed) {
+      socket = WiFiServer::connect();
+    }
+    socket->output.clear();
+    sent = 0;
+  }
+
+  // Feeds the request and returns true once its response is complete.
+  bool step() {
+    size_t length = strlen(request);
+    if (sent < length) {
+      size_t n = slow ? 1 : length;
+      socket->input.append(request + sent, n);
+      sent += n;
+    }
+    const std::string& out = socket->output;
+    bool done = keepAlive ? out.size() >= 5 &&
+                                out.compare(out.size() - 5, 5, "0\r\n\r\n") == 0
+                          : socket->serverClosed && !out.empty();
+    if (done) {
+      served++;
+      start();
+    }
+    return done;
+  }
+};
+
+// Four clients, one of them sending slowly, served by an EventServer. One
+// connection at a time without keep-alive is how the synchronous WebServer
+// serves them, the host WebServer only dispatches and has no sockets to
+// time.
+static void runServerSuite() {
+  struct {
+    int value;
+  } config = {0};
+  const size_t loops = 4000;
+
+  for (int concurrent = 0; concurrent < 2; concurrent++) {
+    const char* name =
+        concurrent ? "load x4 (keep-alive)" : "load x4 (one at a time)";
+    if (!enabled(name)) {
+      continue;
+    }
+
+    EventServer* server = NULL;
+    ConfigManager* cm = new ConfigManager();
+    cm->setServer([&server, concurrent](int port) {
+      server = new EventServer(port, concurrent ? 4 : 1);
+      return server;
+    });
+    seedStorage();
+    WiFi.available = true;
+    WiFi.connected = false;
+    cm->begin(config);
+
+    LoadClient clients[4];
+    for (size_t i = 0; i < 4; i++) {
+      clients[i].keepAlive = concurrent;
+      clients[i].slow = i == 0;
+      clients[i].request =
+          concurrent ? "GET /settings HTTP/1.1\r\nHost: 10.0.0.2\r\n\r\n"
+                     : "GET /settings HTTP/1.1\r\nHost: 10.0.0.2\r\n"
+                       "Connection: close\r\n\r\n";
+      clients[i].served = 0;
+      clients[i].start();
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    for (size_t l = 0; l < loops; l++) {
+      for (size_t i = 0; i < 4; i++) {
+        clients[i].step();
+      }
+      cm->loop();
+    }
+    double nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - started)
+                       .count();
+
+    unsigned long fast = clients[1].served + clients[2].served +
+                         clients[3].served;
+    printf("%-28s %6s %14.0f ns/req, %.2f req/loop, %lu slow\n", name, "-",
+           fast ? nanos / fast : 0, (double)fast / loops, clients[0].served);
+  }
+}
+
+// A burst of five single field PUTs, like a UI moving sliders, committed
+// on every request or once when deferred.
+static void runCommitSuite() {
+  static BenchConfig<10> config;
+  memset(&config, 0, sizeof(config));
+
+  for (int deferred = 0; deferred < 2; deferred++) {
+    const char* name = deferred ? "PUT /settings x5 (deferred)"
+                                : "PUT /settings x5";
+    WebServer* server = NULL;
+    ConfigManager* cm = new ConfigManager();
+    cm->setAPICallback([&server](WebServer* s) { server = s; });
+    if (deferred) {
+      cm->setCommitDelay(500, 2000);
+    }
+    addParameters<10>(*cm, config);
+    seedStorage();
+    WiFi.available = true;
+    WiFi.connected = false;
+    cm->begin(config);
+
+    unsigned long value = 0;
+    CommitStats before = cm->getCommitStats();
+    unsigned long bursts = 0;
+    BENCH(name, 0, {
+      for (int i = 0; i < 5; i++) {
+        char body[32];
+        snprintf(body, sizeof(body), "{\"%s\":%lu}", paramNames[0], ++value);
+        server->request(HTTP_PUT, "/settings", body, mimeJSON);
+      }
+      cm->flush();
+      bursts++;
+    });
+    if (enabled(name)) {
+      printf("%-28s %6s %14.1f commits/burst\n", name, "-",
+             (double)(cm->getCommitStats().performed - before.performed) /
+                 bursts);
+    }
+  }
+}
+
+template <size_t Size>
+struct BootConfig {
+  uint8_t bytes[Size];
+};
+
+// Bytes the storage backends wrote so far. The EEPROM emulation rewrites
+// its whole sector on every commit.
+static unsigned long storageBytesWritten(ConfigStorage* storage,
+                                         bool hostFile) {
+  unsigned long written = ESP.flashBytesWritten + hostNVS.bytesWritten +
+                          fs::File::bytesWritten() +
+                          EEPROM.commits * EEPROM.length();
+  if (hostFile) {
+    written += ((HostFileStorage*)storage)->bytesWritten;
+  }
+  return written;
+}
+
+// Read, write and commit latency of each storage backend, and the heap
+// it holds once begun. The commit persists one changed field.
+template <size_t Size>
+static void runStorageSuite() {
+  const char* names[] = {"eeprom", "journal", "slots", "littlefs", "nvs",
+                         "host file"};
+  static uint8_t buffer[Size];
+
+  for (size_t b = 0; b < sizeof(names) / sizeof(names[0]); b++) {
+    EEPROM.reset();
+    LittleFS.files.clear();
+    HostHeap before = hostHeapMark();
+
+    ConfigStorage* storage = NULL;
+    size_t footprint = 0;
+    switch (b) {
+      case 0:
+        storage = new EEPROMStorage();
+        footprint = sizeof(EEPROMStorage);
+        break;
+      case 1:
+        storage = new JournalStorage(600, 4);
+        footprint = sizeof(JournalStorage);
+        break;
+      case 2:
+        storage = new SlotStorage(700);
+        footprint = sizeof(SlotStorage);
+        break;
+      case 3:
+        storage = new FileStorage(LittleFS, "/config.bin");
+        footprint = sizeof(FileStorage);
+        break;
+      case 4:
+        storage = new NVSStorage("bench", "image");
+        footprint = sizeof(NVSStorage);
+        break;
+      default:
+        storage = new HostFileStorage("build/bench-storage.bin");
+        footprint = sizeof(HostFileStorage);
+        break;
+    }
+    storage->begin(Size);
+    size_t heap = hostHeap.inUse - before.inUse;
+
+    char name[40];
+    snprintf(name, sizeof(name), "storage read (%s)", names[b]);
+    BENCH(name, Size, { storage->read(0, buffer, Size); });
+
+    uint32_t value = 0;
+    snprintf(name, sizeof(name), "storage write (%s)", names[b]);
+    BENCH(name, Size, {
+      value++;
+      storage->write(Size / 2, &value, sizeof(value));
+    });
+
+    StorageRange range = {Size / 2, Size / 2 + sizeof(value)};
+    snprintf(name, sizeof(name), "storage commit (%s)", names[b]);
+    unsigned long written = storageBytesWritten(storage, b == 5);
+    unsigned long commits = 0;
+    BENCH(name, Size, {
+      value++;
+      storage->write(Size / 2, &value, sizeof(value));
+      storage->commit(&range, 1);
+      commits++;
+    });
+    snprintf(name, sizeof(name), "storage flash/commit (%s)", names[b]);
+    reportSize(name, Size,
+               (storageBytesWritten(storage, b == 5) - written) /
+                   (commits ? commits : 1));
+
+    // The EEPROM emulation's buffer lives inside the core, the host
+    // EEPROM allocates it.
+    snprintf(name, sizeof(name), "storage ram (%s)", names[b]);
+    reportSize(name, Size, footprint + heap);
+    delete storage;
+  }
+  EEPROM.reset();
+}
+
+// Boot cost by config size, copied into the struct or mapped in place.
+template <size_t Size>
+static void runBootSuite() {
+  static BootConfig<Size> config;
+  char name[2][40];
+  // Configs the ESP8266 EEPROM cannot hold boot from slots.
+  bool eeprom = fitsEEPROM(Size);
+  const char* on = eeprom ? "" : ", slots";
+  snprintf(name[0], sizeof(name[0]), "begin (%zu B%s)", Size, on);
+  snprintf(name[1], sizeof(name[1]), "begin (mapped, %zu B%s)", Size, on);
+
+  SlotStorage* slots = NULL;
+  if (!eeprom) {
+    slots = new SlotStorage(800, slotSectors(Size));
+    seedStorage(*slots);
+  }
+  seedStorage();
+  WiFi.available = true;
+
+  ConfigManager* cm = new ConfigManager();
+  if (slots) {
+    cm->setStorage(slots);
+  }
+  BENCH(name[0], 0, {
+    WiFi.connected = false;
+    cm->begin(config);
+  });
+
+  ConfigManager* mm = new ConfigManager();
+  if (slots) {
+    mm->setStorage(slots);
+  }
+  BENCH(name[1], 0, {
+    WiFi.connected = false;
+    mm->beginMapped<BootConfig<Size> >();
+  });
+}
+
+// Time begin() holds up the sketch while the network is out of reach. The
+// host delay() only advances the clock, so this is the time a device waits.
+static void runWifiSuite() {
+  struct {
+    int value;
+  } config = {0};
+
+  for (int async = 0; async < 2; async++) {
+    const char* name = async ? "begin blocked (async)" : "begin blocked";
+    if (!enabled(name)) {
+      continue;
+    }
+
+    ConfigManager* cm = new ConfigManager();
+    cm->setWifiConnectAsync(async);
+    seedStorage();
+    WiFi.available = false;
+    WiFi.connected = false;
+
+    unsigned long start = millis();
+    cm->begin(config);
+    printf("%-28s %6s %14lu ms\n", name, "-", millis() - start);
+  }
+  WiFi.available = true;
+
+  // Model a scan and a DHCP exchange, the second boot reuses the cache.
+  WiFi.scanMillis = 2500;
+  WiFi.dhcpMillis = 1000;
+  const char* names[] = {"connect (full)", "connect (fast)",
+                         "connect (fast, static ip)"};
+  for (int mode = 0; mode < 3; mode++) {
+    if (!enabled(names[mode])) {
+      continue;
+    }
+
+    seedStorage();
+    unsigned long time = 0;
+    for (int boot = 0; boot < 2; boot++) {
+      ConfigManager* cm = new ConfigManager();
+      cm->setWifiFastConnect(mode > 0, mode > 1);
+      WiFi.connected = false;
+      WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0),
+                  IPAddress((uint32_t)0));
+      cm->begin(config);
+      time = cm->getWifiConnectTime();
+    }
+    printf("%-28s %6s %14lu ms\n", names[mode], "-", time);
+  }
+  WiFi.scanMillis = 0;
+  WiFi.dhcpMillis = 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    benchFilter = argv[1];
+  }
+
+  for (size_t i = 0; i < 1000; i++) {
+    snprintf(paramNames[i], sizeof(paramNames[i]), "p%zu", i);
+  }
+
+  printf("%-28s %6s %14s %12s %12s\n", "benchmark", "params", "ns/op",
+         "allocs/op", "peak heap");
+  runSuite<10>();
+  runSuite<100>();
+  runSuite<1000>();
+  runSchemaSuite();
+  runAssetSuite();
+  runPortalSuite();
+  runDNSSuite();
+  runServerSuite();
+  runMetricsSuite();
+  runCommitSuite();
+  runStorageSuite<256>();
+  runStorageSuite<2048>();
+  runBootSuite<256>();
+  runBootSuite<4096>();
+  runBootSuite<32768>();
+  runWifiSuite();
+
+  return 0;
+}
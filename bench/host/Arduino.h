@@ -0,0 +1,320 @@
+#ifndef __HOST_ARDUINO_H__
+#define __HOST_ARDUINO_H__
+
+// Minimal stand-in for the Arduino core so ConfigManager can be built and
+// measured on a host machine. Only what the library touches is provided.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::max;
+using std::min;
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_ptr(addr) (*(const void* const*)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strncpy_P strncpy
+#define snprintf_P snprintf
+
+class __FlashStringHelper;
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper*>(p))
+#define F(s) FPSTR(s)
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+long random(long max);
+
+/**
+ * String
+ */
+class String {
+ public:
+  String() {}
+  String(const char* str) : buf(str ? str : "") {}
+  String(const __FlashStringHelper* str)
+      : buf(str ? reinterpret_cast<const char*>(str) : "") {}
+  String(const std::string& str) : buf(str) {}
+  explicit String(char c) : buf(1, c) {}
+  explicit String(int value) : buf(std::to_string(value)) {}
+  explicit String(unsigned int value) : buf(std::to_string(value)) {}
+  explicit String(long value) : buf(std::to_string(value)) {}
+  explicit String(unsigned long value) : buf(std::to_string(value)) {}
+  explicit String(unsigned char value) : buf(std::to_string(value)) {}
+  explicit String(float value, unsigned char decimals = 2);
+  explicit String(double value, unsigned char decimals = 2);
+
+  const char* c_str() const { return buf.c_str(); }
+  unsigned int length() const { return buf.length(); }
+  bool reserve(unsigned int size) {
+    buf.reserve(size);
+    return true;
+  }
+  char charAt(unsigned int index) const {
+    return index < buf.length() ? buf[index] : 0;
+  }
+  char operator[](unsigned int index) const { return charAt(index); }
+
+  bool concat(const char* str) {
+    buf.append(str);
+    return true;
+  }
+  bool concat(const char* str, unsigned int length) {
+    buf.append(str, length);
+    return true;
+  }
+  bool concat(const String& str) {
+    buf.append(str.buf);
+    return true;
+  }
+  bool concat(char c) {
+    buf.push_back(c);
+    return true;
+  }
+
+  String& operator+=(const String& rhs) {
+    concat(rhs);
+    return *this;
+  }
+  String& operator+=(const char* rhs) {
+    concat(rhs);
+    return *this;
+  }
+  String& operator+=(char rhs) {
+    concat(rhs);
+    return *this;
+  }
+
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t pos = buf.find(c, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  int indexOf(const String& str, unsigned int from = 0) const {
+    size_t pos = buf.find(str.buf, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  bool startsWith(const String& prefix) const {
+    return buf.compare(0, prefix.buf.length(), prefix.buf) == 0;
+  }
+  bool endsWith(const String& suffix) const {
+    return buf.length() >= suffix.buf.length() &&
+           buf.compare(buf.length() - suffix.buf.length(),
+                       suffix.buf.length(), suffix.buf) == 0;
+  }
+  String substring(unsigned int from) const { return String(buf.substr(from)); }
+  String substring(unsigned int from, unsigned int to) const {
+    return String(buf.substr(from, to - from));
+  }
+  long toInt() const { return strtol(buf.c_str(), NULL, 10); }
+
+  bool operator==(const String& rhs) const { return buf == rhs.buf; }
+  bool operator==(const char* rhs) const { return buf == (rhs ? rhs : ""); }
+  bool operator==(const __FlashStringHelper* rhs) const {
+    return *this == reinterpret_cast<const char*>(rhs);
+  }
+  bool operator!=(const String& rhs) const { return !(*this == rhs); }
+  bool operator!=(const char* rhs) const { return !(*this == rhs); }
+
+ private:
+  std::string buf;
+};
+
+class StringSumHelper : public String {
+ public:
+  StringSumHelper(const String& s) : String(s) {}
+};
+
+inline StringSumHelper operator+(const String& lhs, const String& rhs) {
+  String res(lhs);
+  res += rhs;
+  return res;
+}
+inline StringSumHelper operator+(const String& lhs, const char* rhs) {
+  String res(lhs);
+  res += rhs;
+  return res;
+}
+
+/**
+ * Print
+ */
+class Printable;
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+      n += write(*buffer++);
+    }
+    return n;
+  }
+  size_t write(const char* str) {
+    return str ? write((const uint8_t*)str, strlen(str)) : 0;
+  }
+  size_t write(const char* buffer, size_t size) {
+    return write((const uint8_t*)buffer, size);
+  }
+
+  size_t print(const char* str) { return write(str); }
+  size_t print(const String& str) { return write(str.c_str()); }
+  size_t print(const __FlashStringHelper* str) {
+    return write(reinterpret_cast<const char*>(str));
+  }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value) { return print(String(value)); }
+  size_t print(unsigned int value) { return print(String(value)); }
+  size_t print(long value) { return print(String(value)); }
+  size_t print(unsigned long value) { return print(String(value)); }
+  size_t print(double value) { return print(String(value)); }
+  size_t print(double value, int digits) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    return write(buffer);
+  }
+  size_t print(const Printable& value);
+
+  template <typename T>
+  size_t println(const T& value) {
+    size_t n = print(value);
+    return n + print("\r\n");
+  }
+  size_t println() { return print("\r\n"); }
+};
+
+class Printable {
+ public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+inline size_t Print::print(const Printable& value) {
+  return value.printTo(*this);
+}
+
+/**
+ * Stream
+ */
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+  size_t readBytes(char* buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+      int c = read();
+      if (c < 0) {
+        break;
+      }
+      *buffer++ = (char)c;
+      count++;
+    }
+    return count;
+  }
+  size_t readBytes(uint8_t* buffer, size_t length) {
+    return readBytes((char*)buffer, length);
+  }
+
+ protected:
+  unsigned long timeout = 1000;
+};
+
+/**
+ * Host Serial, discards all output.
+ */
+class HostSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t*, size_t size) { return size; }
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+};
+
+extern HostSerial Serial;
+
+/**
+ * IPAddress
+ */
+class IPAddress : public Printable {
+ public:
+  IPAddress() { address.dword = 0; }
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    address.bytes[0] = a;
+    address.bytes[1] = b;
+    address.bytes[2] = c;
+    address.bytes[3] = d;
+  }
+  IPAddress(uint32_t value) { address.dword = value; }
+
+  operator uint32_t() const { return address.dword; }
+  uint8_t operator[](int index) const { return address.bytes[index]; }
+  uint8_t& operator[](int index) { return address.bytes[index]; }
+
+  String toString() const;
+  size_t printTo(Print& p) const { return p.print(toString()); }
+
+ private:
+  union {
+    uint8_t bytes[4];
+    uint32_t dword;
+  } address;
+};
+
+// Flash sector size, the most the ESP8266 EEPROM emulation can hold.
+#define SPI_FLASH_SEC_SIZE 4096
+
+/**
+ * ESP
+ */
+class HostESP {
+ public:
+  void restart() { restarts++; }
+  uint32_t getFreeHeap();
+  // The host heap is not fragmented, the largest block is all of it.
+  uint32_t getMaxAllocHeap() { return getFreeHeap(); }
+
+  // Raw flash, emulated as NOR: erases set bytes to 0xFF, writes only clear
+  // bits.
+  bool flashEraseSector(uint32_t sector);
+  bool flashWrite(uint32_t offset, uint32_t* data, size_t size);
+  bool flashRead(uint32_t offset, uint32_t* data, size_t size);
+
+  unsigned long restarts = 0;
+  unsigned long flashErases = 0;
+  unsigned long flashWrites = 0;
+  unsigned long flashBytesWritten = 0;
+  // Flash erases and writes that still succeed, negative for no limit. Once
+  // it reaches 0 every erase and write fails, like after a power cut.
+  long flashOpsLeft = -1;
+};
+
+extern HostESP ESP;
+
+#endif /* __HOST_ARDUINO_H__ */
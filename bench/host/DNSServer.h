@@ -0,0 +1,37 @@
+#ifndef __HOST_DNSSERVER_H__
+#define __HOST_DNSSERVER_H__
+
+#include <Arduino.h>
+
+enum class DNSReplyCode {
+  NoError = 0,
+  FormError = 1,
+  ServerFailure = 2,
+  NonExistentDomain = 3,
+  NotImplemented = 4,
+  Refused = 5,
+};
+
+/**
+ * Host DNSServer, counts the requests it was asked to process.
+ */
+class DNSServer {
+ public:
+  void setErrorReplyCode(const DNSReplyCode& code) { replyCode = code; }
+  bool start(const uint16_t& port,
+             const String& domainName,
+             const IPAddress& resolvedIP) {
+    (void)port;
+    (void)domainName;
+    ip = resolvedIP;
+    return true;
+  }
+  void stop() {}
+  void processNextRequest() { processed++; }
+
+  DNSReplyCode replyCode = DNSReplyCode::NonExistentDomain;
+  IPAddress ip;
+  unsigned long processed = 0;
+};
+
+#endif /* __HOST_DNSSERVER_H__ */
@@ -0,0 +1,96 @@
+#ifndef __HOST_EEPROM_H__
+#define __HOST_EEPROM_H__
+
+#include <Arduino.h>
+
+#include <vector>
+
+/**
+ * Host EEPROM, a RAM image mirroring the ESP emulated EEPROM API. Sizes are
+ * limited to a flash sector like on the ESP8266, the tighter of the cores.
+ */
+class EEPROMClass {
+ public:
+  void begin(size_t size) {
+    // The ESP8266 core refuses the size and leaves the buffer as it was.
+    if (size == 0 || size > SPI_FLASH_SEC_SIZE) {
+      return;
+    }
+    if (size > data.size()) {
+      data.resize(size, 0xFF);
+    }
+  }
+  void end() {}
+
+  uint8_t read(int address) { return data[address]; }
+  void write(int address, uint8_t value) {
+    if (data[address] != value) {
+      data[address] = value;
+      dirty = true;
+    }
+    writes++;
+  }
+
+  // ESP32 bulk accessors.
+  size_t readBytes(int address, void* value, size_t maxLen) {
+    if (address + maxLen > data.size()) {
+      return 0;
+    }
+    memcpy(value, &data[address], maxLen);
+    return maxLen;
+  }
+  size_t writeBytes(int address, const void* value, size_t len) {
+    if (address + len > data.size()) {
+      return 0;
+    }
+    memcpy(&data[address], value, len);
+    dirty = true;
+    writes++;
+    return len;
+  }
+
+  template <typename T>
+  T& get(int address, T& t) {
+    memcpy((uint8_t*)&t, &data[address], sizeof(T));
+    return t;
+  }
+
+  template <typename T>
+  const T& put(int address, const T& t) {
+    const uint8_t* ptr = (const uint8_t*)&t;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      write(address + i, ptr[i]);
+    }
+    return t;
+  }
+
+  bool commit() {
+    commits++;
+    dirty = false;
+    return true;
+  }
+
+  uint8_t* getDataPtr() {
+    dirty = true;
+    return data.data();
+  }
+  const uint8_t* getConstDataPtr() const { return data.data(); }
+  size_t length() const { return data.size(); }
+
+  // Host helpers.
+  void reset() {
+    data.clear();
+    dirty = false;
+    writes = 0;
+    commits = 0;
+  }
+
+  std::vector<uint8_t> data;
+  bool dirty = false;
+  unsigned long writes = 0;
+  unsigned long commits = 0;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif /* __HOST_EEPROM_H__ */
@@ -0,0 +1,128 @@
+#ifndef __HOST_FS_H__
+#define __HOST_FS_H__
+
+#include <Arduino.h>
+
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+/**
+ * Host File, reads and writes an in-memory copy of the file contents.
+ */
+class File : public Stream {
+ public:
+  File() {}
+  File(const char* name, std::string* contents, bool writable = false)
+      : path(name), contents(contents), writable(writable) {}
+
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t length) {
+    if (!contents || !writable) {
+      return 0;
+    }
+    if (position + length > contents->size()) {
+      contents->resize(position + length);
+    }
+    memcpy(&(*contents)[position], buffer, length);
+    position += length;
+    bytesWritten() += length;
+    return length;
+  }
+  int available() {
+    return contents ? (int)(contents->size() - position) : 0;
+  }
+  int read() {
+    return available() > 0 ? (uint8_t)(*contents)[position++] : -1;
+  }
+  int peek() { return available() > 0 ? (uint8_t)(*contents)[position] : -1; }
+  size_t read(uint8_t* buffer, size_t length) {
+    size_t n = std::min(length, (size_t)available());
+    memcpy(buffer, contents->data() + position, n);
+    position += n;
+    return n;
+  }
+  bool seek(uint32_t pos, SeekMode mode = SeekSet) {
+    if (!contents) {
+      return false;
+    }
+    size_t base = mode == SeekSet ? 0
+                  : mode == SeekCur ? position
+                                    : contents->size();
+    if (base + pos > contents->size()) {
+      return false;
+    }
+    position = base + pos;
+    return true;
+  }
+  size_t size() const { return contents ? contents->size() : 0; }
+  const char* name() const { return path.c_str(); }
+  time_t getLastWrite() { return 0; }
+  void close() { contents = NULL; }
+
+  operator bool() const { return contents != NULL; }
+
+  // Host helpers.
+  static unsigned long& bytesWritten() {
+    static unsigned long count = 0;
+    return count;
+  }
+
+ private:
+  std::string path;
+  std::string* contents = NULL;
+  bool writable = false;
+  size_t position = 0;
+};
+
+/**
+ * Host FS, a flat map of path to contents.
+ */
+class FS {
+ public:
+  bool begin(bool formatOnFail = false) {
+    (void)formatOnFail;
+    mounts++;
+    return true;
+  }
+  void end() {}
+
+  // "r" reads, "w" truncates or creates, "r+" updates an existing file.
+  File open(const char* path, const char* mode = "r") {
+    if (mode[0] == 'w') {
+      std::string& contents = files[path];
+      contents.clear();
+      return File(path, &contents, true);
+    }
+    std::map<std::string, std::string>::iterator it = files.find(path);
+    if (it == files.end()) {
+      return File();
+    }
+    return File(path, &it->second, mode[1] == '+');
+  }
+  File open(const String& path, const char* mode = "r") {
+    return open(path.c_str(), mode);
+  }
+  bool exists(const char* path) { return files.count(path) > 0; }
+  bool exists(const String& path) { return exists(path.c_str()); }
+
+  // Host helpers.
+  std::map<std::string, std::string> files;
+  unsigned long mounts = 0;
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif /* __HOST_FS_H__ */
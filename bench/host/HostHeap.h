@@ -0,0 +1,22 @@
+#ifndef __HOST_HEAP_H__
+#define __HOST_HEAP_H__
+
+#include <stddef.h>
+
+/**
+ * Host heap accounting, fed by the malloc, calloc, realloc and free
+ * interposed in host.cpp. operator new and delete reach them through libc.
+ */
+struct HostHeap {
+  size_t allocations;
+  size_t frees;
+  size_t inUse;
+  size_t peak;
+};
+
+extern HostHeap hostHeap;
+
+// Resets the peak to the current usage and returns a snapshot.
+HostHeap hostHeapMark();
+
+#endif /* __HOST_HEAP_H__ */
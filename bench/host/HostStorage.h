@@ -0,0 +1,82 @@
+#ifndef __HOST_STORAGE_H__
+#define __HOST_STORAGE_H__
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "ConfigStorage.h"
+
+/**
+ * Host File Storage
+ *
+ * The image in a file on the host's disk, for running the library natively.
+ * A commit writes the changed ranges in place and syncs the file.
+ */
+class HostFileStorage : public ConfigStorage {
+ public:
+  HostFileStorage(const char* path) : path(path) {}
+  ~HostFileStorage() {
+    if (file) {
+      fclose(file);
+    }
+  }
+
+  bool begin(size_t size) {
+    this->size = size;
+    image.reset(new uint8_t[size]);
+    memset(image.get(), 0xFF, size);
+
+    file = fopen(path, "r+b");
+    if (file) {
+      size_t stored = fread(image.get(), 1, size, file);
+      fseek(file, 0, SEEK_END);
+      complete = stored == size && (size_t)ftell(file) == size;
+      return true;
+    }
+    file = fopen(path, "w+b");
+    return file != NULL;
+  }
+  void read(size_t address, void* data, size_t length) {
+    if (address + length <= size) {
+      memcpy(data, image.get() + address, length);
+    }
+  }
+  void write(size_t address, const void* data, size_t length) {
+    if (address + length <= size) {
+      memcpy(image.get() + address, data, length);
+    }
+  }
+  bool commit(const StorageRange* ranges, size_t count) {
+    if (!file) {
+      return false;
+    }
+
+    bool ok = true;
+    if (!complete || ranges == NULL) {
+      ok = fseek(file, 0, SEEK_SET) == 0 &&
+           fwrite(image.get(), 1, size, file) == size;
+      bytesWritten += size;
+      complete = ok;
+    } else {
+      for (size_t i = 0; i < count && ok; i++) {
+        size_t length = ranges[i].end - ranges[i].start;
+        ok = fseek(file, ranges[i].start, SEEK_SET) == 0 &&
+             fwrite(image.get() + ranges[i].start, 1, length, file) == length;
+        bytesWritten += length;
+      }
+    }
+    return ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+  }
+  uint8_t* data() { return image.get(); }
+
+  unsigned long bytesWritten = 0;
+
+ private:
+  const char* path;
+  FILE* file = NULL;
+  std::unique_ptr<uint8_t[]> image;
+  size_t size = 0;
+  bool complete = false;
+};
+
+#endif /* __HOST_STORAGE_H__ */
@@ -0,0 +1,8 @@
+#ifndef __HOST_LITTLEFS_H__
+#define __HOST_LITTLEFS_H__
+
+#include <FS.h>
+
+extern fs::FS LittleFS;
+
+#endif /* __HOST_LITTLEFS_H__ */
@@ -0,0 +1,8 @@
+#ifndef __HOST_SPIFFS_H__
+#define __HOST_SPIFFS_H__
+
+#include <FS.h>
+
+extern fs::FS SPIFFS;
+
+#endif /* __HOST_SPIFFS_H__ */
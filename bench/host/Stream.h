@@ -0,0 +1,7 @@
+#ifndef __HOST_STREAM_H__
+#define __HOST_STREAM_H__
+
+// ArduinoJson includes the core headers by their individual names.
+#include <Arduino.h>
+
+#endif /* __HOST_STREAM_H__ */
@@ -0,0 +1,266 @@
+#ifndef __HOST_WEBSERVER_H__
+#define __HOST_WEBSERVER_H__
+
+#include <FS.h>
+#include <WiFi.h>
+
+#include <chrono>
+#include <utility>
+#include <vector>
+
+enum HTTPMethod {
+  HTTP_ANY,
+  HTTP_GET,
+  HTTP_HEAD,
+  HTTP_POST,
+  HTTP_PUT,
+  HTTP_PATCH,
+  HTTP_DELETE,
+  HTTP_OPTIONS,
+};
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define CONTENT_LENGTH_NOT_SET ((size_t)-2)
+
+/**
+ * Host WebServer, mirrors the synchronous ESP WebServer API. Requests are
+ * injected by the harness through request() and the response is recorded.
+ */
+class WebServer {
+ public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  struct Response {
+    int code = 0;
+    String contentType;
+    std::vector<std::pair<String, String>> headers;
+    std::string body;
+    // Time from dispatch until the status line would go out.
+    unsigned long firstByteNanos = 0;
+  };
+
+  WebServer(int port = 80) : port(port) {}
+
+  void begin() { running = true; }
+  void stop() { running = false; }
+  void handleClient() { polls++; }
+  void enableCORS(bool enable = true) { cors = enable; }
+
+  void on(const String& uri, HTTPMethod method, THandlerFunction fn) {
+    Route route;
+    route.uri = uri;
+    route.method = method;
+    route.fn = fn;
+    routes.push_back(route);
+  }
+  void onNotFound(THandlerFunction fn) { notFound = fn; }
+  void collectHeaders(const char* headerKeys[], const size_t headerKeysCount) {
+    collected.clear();
+    for (size_t i = 0; i < headerKeysCount; i++) {
+      collected.push_back(String(headerKeys[i]));
+    }
+  }
+
+  String uri() { return _currentUri; }
+  HTTPMethod method() { return currentMethod; }
+  String arg(const String& name) {
+    for (size_t i = 0; i < args.size(); i++) {
+      if (args[i].first == name) {
+        return args[i].second;
+      }
+    }
+    return String();
+  }
+  bool hasArg(const String& name) {
+    for (size_t i = 0; i < args.size(); i++) {
+      if (args[i].first == name) {
+        return true;
+      }
+    }
+    return false;
+  }
+  String header(const String& name) {
+    for (size_t i = 0; i < requestHeaders.size(); i++) {
+      if (requestHeaders[i].first == name && isCollected(name)) {
+        return requestHeaders[i].second;
+      }
+    }
+    return String();
+  }
+  bool hasHeader(const String& name) { return header(name).length() > 0; }
+  String hostHeader() { return _hostHeader; }
+  WiFiClient& client() { return currentClient; }
+
+  void setContentLength(const size_t length) { contentLength = length; }
+  void sendHeader(const String& name, const String& value, bool first = false) {
+    if (first) {
+      response.headers.insert(response.headers.begin(),
+                              std::make_pair(name, value));
+    } else {
+      response.headers.push_back(std::make_pair(name, value));
+    }
+  }
+  void send(int code, const char* contentType = NULL,
+            const String& content = String("")) {
+    send(code, String(contentType), content);
+  }
+  void send(int code, const String& contentType, const String& content) {
+    markFirstByte();
+    response.code = code;
+    response.contentType = contentType;
+    response.body.append(content.c_str(), content.length());
+    bytesSent += content.length();
+  }
+  void send_P(int code, PGM_P contentType, PGM_P content) {
+    send(code, String(contentType), String(content));
+  }
+  void send_P(int code, PGM_P contentType, PGM_P content, size_t length) {
+    markFirstByte();
+    response.code = code;
+    response.contentType = String(contentType);
+    response.body.append(content, length);
+    bytesSent += length;
+  }
+  void sendContent(const String& content) {
+    sendContent(content.c_str(), content.length());
+  }
+  void sendContent(const char* content, size_t length) {
+    markFirstByte();
+    response.body.append(content, length);
+    bytesSent += length;
+    chunks++;
+  }
+  void sendContent_P(PGM_P content, size_t length) {
+    sendContent(content, length);
+  }
+
+  template <typename T>
+  size_t streamFile(T& file, const String& contentType) {
+    markFirstByte();
+    // Like the cores, gzip files are sent with their content encoding.
+    String name(file.name());
+    if (name.length() > 3 &&
+        strcmp(name.c_str() + name.length() - 3, ".gz") == 0) {
+      sendHeader("Content-Encoding", "gzip");
+    }
+    response.code = 200;
+    response.contentType = contentType;
+    size_t total = 0;
+    uint8_t buffer[256];
+    size_t n;
+    while ((n = file.read(buffer, sizeof(buffer))) > 0) {
+      response.body.append((const char*)buffer, n);
+      total += n;
+    }
+    bytesSent += total;
+    return total;
+  }
+
+  // Host helpers.
+
+  /**
+   * Dispatch a single request and return the recorded response.
+   */
+  const Response& request(HTTPMethod method,
+                          const char* uri,
+                          const char* body = NULL,
+                          const char* contentType = NULL) {
+    std::vector<std::pair<String, String>> headers;
+    if (contentType) {
+      headers.push_back(std::make_pair(String("Content-Type"),
+                                       String(contentType)));
+    }
+    return request(method, uri, body, headers);
+  }
+  const Response& request(HTTPMethod method,
+                          const char* uri,
+                          const char* body,
+                          const std::vector<std::pair<String, String>>& headers) {
+    return request(method, uri, body ? std::string(body) : std::string(),
+                   headers, body != NULL);
+  }
+
+  // Binary safe variant, the body may contain NUL bytes.
+  const Response& request(HTTPMethod method,
+                          const char* uri,
+                          const std::string& body,
+                          const std::vector<std::pair<String, String>>& headers,
+                          bool hasBody = true) {
+    response = Response();
+    started = std::chrono::steady_clock::now();
+    contentLength = CONTENT_LENGTH_NOT_SET;
+    currentMethod = method;
+    _currentUri = uri;
+    currentClient = WiFiClient();
+    requestHeaders = headers;
+    args.clear();
+    if (hasBody) {
+      args.push_back(std::make_pair(String("plain"), String(body)));
+    }
+
+    for (size_t i = 0; i < routes.size(); i++) {
+      if ((routes[i].method == HTTP_ANY || routes[i].method == method) &&
+          routes[i].uri == _currentUri) {
+        routes[i].fn();
+        return response;
+      }
+    }
+    if (notFound) {
+      notFound();
+    }
+    return response;
+  }
+
+  // Host header of the requests that follow.
+  void setHost(const char* host) { _hostHeader = host; }
+
+  int port;
+  bool running = false;
+  bool cors = false;
+  size_t contentLength = CONTENT_LENGTH_NOT_SET;
+  unsigned long polls = 0;
+  unsigned long chunks = 0;
+  unsigned long bytesSent = 0;
+  Response response;
+
+ protected:
+  // Named like the cores, which only return copies of them.
+  String _currentUri;
+  String _hostHeader = "192.168.1.1";
+
+ private:
+  struct Route {
+    String uri;
+    HTTPMethod method;
+    THandlerFunction fn;
+  };
+
+  void markFirstByte() {
+    if (response.firstByteNanos == 0) {
+      response.firstByteNanos =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - started)
+              .count();
+    }
+  }
+
+  bool isCollected(const String& name) {
+    for (size_t i = 0; i < collected.size(); i++) {
+      if (collected[i] == name) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<Route> routes;
+  THandlerFunction notFound;
+  std::vector<String> collected;
+  std::vector<std::pair<String, String>> requestHeaders;
+  std::vector<std::pair<String, String>> args;
+  HTTPMethod currentMethod = HTTP_GET;
+  WiFiClient currentClient;
+  std::chrono::steady_clock::time_point started;
+};
+
+#endif /* __HOST_WEBSERVER_H__ */
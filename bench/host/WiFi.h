@@ -0,0 +1,278 @@
+#ifndef __HOST_WIFI_H__
+#define __HOST_WIFI_H__
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6,
+} wl_status_t;
+
+typedef enum {
+  WIFI_OFF = 0,
+  WIFI_STA = 1,
+  WIFI_AP = 2,
+  WIFI_AP_STA = 3,
+} wifi_mode_t;
+
+typedef enum {
+  WIFI_AUTH_OPEN = 0,
+  WIFI_AUTH_WEP,
+  WIFI_AUTH_WPA_PSK,
+  WIFI_AUTH_WPA2_PSK,
+} wifi_auth_mode_t;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+/**
+ * Host Socket, the two directions of a connection between the harness and
+ * a WiFiClient.
+ */
+struct HostSocket {
+  std::string input;  // sent by the harness, read by the server
+  size_t inputRead = 0;
+  std::string output;  // written by the server
+  bool serverClosed = false;
+  bool clientClosed = false;
+
+  void send(const char* data) { input.append(data); }
+};
+
+/**
+ * Host WiFiClient, the connection a request arrived on. Without a socket
+ * it only counts the bytes written to it.
+ */
+class WiFiClient : public Stream {
+ public:
+  WiFiClient() {}
+  explicit WiFiClient(std::shared_ptr<HostSocket> socket) : socket(socket) {}
+
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* data, size_t size) {
+    bytesWritten += size;
+    if (socket) {
+      socket->output.append((const char*)data, size);
+    }
+    return size;
+  }
+  int available() {
+    return socket ? (int)(socket->input.size() - socket->inputRead) : 0;
+  }
+  int read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  int read(uint8_t* buffer, size_t size) {
+    size_t n = std::min(size, (size_t)available());
+    if (n > 0) {
+      memcpy(buffer, socket->input.data() + socket->inputRead, n);
+      socket->inputRead += n;
+    }
+    return (int)n;
+  }
+  int peek() {
+    return available() > 0 ? (uint8_t)socket->input[socket->inputRead] : -1;
+  }
+  void setNoDelay(bool noDelay) { (void)noDelay; }
+
+  IPAddress localIP() { return local; }
+  IPAddress remoteIP() { return remote; }
+  void stop() {
+    stopped = true;
+    if (socket) {
+      socket->serverClosed = true;
+    }
+  }
+  uint8_t connected() {
+    if (socket) {
+      return !socket->serverClosed && !socket->clientClosed;
+    }
+    return !stopped;
+  }
+  operator bool() { return socket != nullptr; }
+
+  IPAddress local = IPAddress(192, 168, 1, 1);
+  IPAddress remote = IPAddress(192, 168, 1, 2);
+  bool stopped = false;
+  // Bytes written to the client directly, bypassing the server.
+  unsigned long bytesWritten = 0;
+
+ private:
+  std::shared_ptr<HostSocket> socket;
+};
+
+/**
+ * Host WiFiServer, connections opened by the harness with connect() wait
+ * in the backlog until the server takes them.
+ */
+class WiFiServer {
+ public:
+  WiFiServer(uint16_t port) : port(port) {}
+
+  void begin() { backlog().clear(); }
+  void stop() { backlog().clear(); }
+  void setNoDelay(bool noDelay) { (void)noDelay; }
+  WiFiClient available() {
+    if (backlog().empty()) {
+      return WiFiClient();
+    }
+    WiFiClient client(backlog().front());
+    backlog().pop_front();
+    return client;
+  }
+
+  // Host helpers.
+  static std::shared_ptr<HostSocket> connect() {
+    std::shared_ptr<HostSocket> socket(new HostSocket());
+    backlog().push_back(socket);
+    return socket;
+  }
+  static std::deque<std::shared_ptr<HostSocket>>& backlog() {
+    static std::deque<std::shared_ptr<HostSocket>> pending;
+    return pending;
+  }
+
+  uint16_t port;
+};
+
+/**
+ * A network visible to the host WiFi scan.
+ */
+struct HostNetwork {
+  String ssid;
+  int32_t rssi;
+  wifi_auth_mode_t encryption;
+  uint8_t bssid[6];
+  int32_t channel;
+};
+
+/**
+ * Host WiFi, connection state and scan results are set by the harness.
+ */
+class WiFiClass {
+ public:
+  String macAddress() { return String("24:0A:C4:00:00:01"); }
+  wl_status_t status() {
+    return connected && millis() >= connectAt ? WL_CONNECTED : WL_DISCONNECTED;
+  }
+
+  wl_status_t begin(const char* ssid,
+                    const char* passphrase = NULL,
+                    int32_t channel = 0,
+                    const uint8_t* bssid = NULL,
+                    bool connect = true) {
+    (void)ssid;
+    (void)passphrase;
+    (void)connect;
+    beginCalls++;
+    connected = available;
+    // A known channel and BSSID skip the scan, a static address the DHCP.
+    bool direct = channel > 0 && bssid != NULL;
+    connectAt = millis() + (direct ? 0 : scanMillis) +
+                ((uint32_t)ip != 0 && staticIP ? 0 : dhcpMillis);
+    return status();
+  }
+  bool config(IPAddress local,
+              IPAddress gateway,
+              IPAddress subnet,
+              IPAddress dns1 = (uint32_t)0,
+              IPAddress dns2 = (uint32_t)0) {
+    (void)dns2;
+    staticIP = (uint32_t)local != 0;
+    if (!staticIP) {
+      return true;
+    }
+    ip = local;
+    gateway_ = gateway;
+    subnet_ = subnet;
+    dns_ = dns1;
+    return true;
+  }
+  bool disconnect(bool wifiOff = false) {
+    (void)wifiOff;
+    connected = false;
+    return true;
+  }
+  bool mode(wifi_mode_t m) {
+    currentMode = m;
+    return true;
+  }
+  wifi_mode_t getMode() { return currentMode; }
+
+  bool softAPConfig(IPAddress local, IPAddress gateway, IPAddress subnet) {
+    (void)gateway;
+    (void)subnet;
+    apIP = local;
+    return true;
+  }
+  bool softAP(const char* ssid, const char* passphrase = NULL) {
+    (void)ssid;
+    (void)passphrase;
+    return true;
+  }
+  IPAddress softAPIP() { return apIP; }
+
+  IPAddress localIP() { return ip; }
+  IPAddress gatewayIP() { return gateway_; }
+  IPAddress subnetMask() { return subnet_; }
+  IPAddress dnsIP(uint8_t i = 0) {
+    (void)i;
+    return dns_;
+  }
+  uint8_t* BSSID() { return bssid; }
+  int32_t channel() { return channel_; }
+
+  int16_t scanNetworks(bool async = false) {
+    (void)async;
+    scans++;
+    scanResults = networks;
+    return (int16_t)scanResults.size();
+  }
+  int16_t scanComplete() { return (int16_t)scanResults.size(); }
+  void scanDelete() { scanResults.clear(); }
+
+  String SSID(uint8_t i) { return scanResults[i].ssid; }
+  int32_t RSSI(uint8_t i) { return scanResults[i].rssi; }
+  wifi_auth_mode_t encryptionType(uint8_t i) {
+    return scanResults[i].encryption;
+  }
+  uint8_t* BSSID(uint8_t i) { return scanResults[i].bssid; }
+  int32_t channel(uint8_t i) { return scanResults[i].channel; }
+
+  // Host helpers.
+  bool available = true;
+  bool connected = false;
+  // Simulated connection cost, zero connects right away.
+  unsigned long scanMillis = 0;
+  unsigned long dhcpMillis = 0;
+  unsigned long connectAt = 0;
+  bool staticIP = false;
+  wifi_mode_t currentMode = WIFI_OFF;
+  IPAddress ip = IPAddress(10, 0, 0, 2);
+  IPAddress gateway_ = IPAddress(10, 0, 0, 1);
+  IPAddress subnet_ = IPAddress(255, 255, 255, 0);
+  IPAddress dns_ = IPAddress(10, 0, 0, 1);
+  IPAddress apIP;
+  uint8_t bssid[6] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0xFF};
+  int32_t channel_ = 6;
+  std::vector<HostNetwork> networks;
+  std::vector<HostNetwork> scanResults;
+  unsigned long beginCalls = 0;
+  unsigned long scans = 0;
+};
+
+extern WiFiClass WiFi;
+
+#endif /* __HOST_WIFI_H__ */
@@ -0,0 +1,106 @@
+#ifndef __HOST_WIFIUDP_H__
+#define __HOST_WIFIUDP_H__
+
+#include <Arduino.h>
+
+// Packets the harness can queue at once.
+#define HOST_UDP_QUEUE 64
+
+/**
+ * Host WiFiUDP, packets are queued by the harness through inject() and
+ * the last reply is kept.
+ */
+class WiFiUDP {
+ public:
+  uint8_t begin(uint16_t port) {
+    (void)port;
+    return 1;
+  }
+  void stop() {}
+
+  int parsePacket() {
+    Queue& q = queue();
+    if (q.head == q.tail) {
+      current = NULL;
+      return 0;
+    }
+    current = &q.packets[q.head % HOST_UDP_QUEUE];
+    q.head++;
+    offset = 0;
+    return (int)current->size;
+  }
+  int read(uint8_t* buffer, size_t length) {
+    if (current == NULL) {
+      return -1;
+    }
+    size_t n = current->size - offset;
+    n = n < length ? n : length;
+    memcpy(buffer, current->data + offset, n);
+    offset += n;
+    return (int)n;
+  }
+  IPAddress remoteIP() { return IPAddress(192, 168, 1, 2); }
+  uint16_t remotePort() { return 5353; }
+
+  int beginPacket(IPAddress ip, uint16_t port) {
+    (void)ip;
+    (void)port;
+    replySize = 0;
+    return 1;
+  }
+  size_t write(const uint8_t* buffer, size_t size) {
+    size = size < sizeof(reply) - replySize ? size : sizeof(reply) - replySize;
+    memcpy(reply + replySize, buffer, size);
+    replySize += size;
+    return size;
+  }
+  int endPacket() {
+    replies()++;
+    return 1;
+  }
+
+  // Host helpers.
+
+  /**
+   * Queue a packet for the next parsePacket(). The data is not copied and
+   * must outlive the call, so queueing does not allocate.
+   */
+  static bool inject(const uint8_t* data, size_t size) {
+    Queue& q = queue();
+    if (q.tail - q.head == HOST_UDP_QUEUE) {
+      return false;
+    }
+    q.packets[q.tail % HOST_UDP_QUEUE] = {data, size};
+    q.tail++;
+    return true;
+  }
+  static size_t queued() { return queue().tail - queue().head; }
+  static unsigned long& replies() {
+    static unsigned long count = 0;
+    return count;
+  }
+
+  uint8_t reply[512];
+  size_t replySize = 0;
+
+ private:
+  struct Packet {
+    const uint8_t* data;
+    size_t size;
+  };
+  struct Queue {
+    Packet packets[HOST_UDP_QUEUE];
+    size_t head = 0;
+    size_t tail = 0;
+  };
+
+  static Queue& queue() {
+    static Queue q;
+    return q;
+  }
+
+  const Packet* current = NULL;
+  size_t offset = 0;
+};
+
+#endif /* __HOST_WIFIUDP_H__ */
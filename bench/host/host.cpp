@@ -0,0 +1,198 @@
+#include <Arduino.h>
+#include <DNSServer.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <SPIFFS.h>
+#include <WiFi.h>
+#include <malloc.h>
+#include <nvs.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <vector>
+
+#include "HostHeap.h"
+
+HostSerial Serial;
+HostESP ESP;
+EEPROMClass EEPROM;
+fs::FS SPIFFS;
+fs::FS LittleFS;
+HostNVS hostNVS;
+WiFiClass WiFi;
+
+//
+// Time
+//
+static unsigned long delayed = 0;
+
+static unsigned long long monotonicMicros() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+unsigned long millis() {
+  return (unsigned long)(monotonicMicros() / 1000) + delayed;
+}
+
+unsigned long micros() {
+  return (unsigned long)monotonicMicros() + delayed * 1000;
+}
+
+// delay only advances the clock so blocking paths cost no wall time.
+void delay(unsigned long ms) {
+  delayed += ms;
+}
+
+void yield() {}
+
+long random(long max) {
+  return max > 0 ? rand() % max : 0;
+}
+
+//
+// Flash
+//
+#define HOST_FLASH_SIZE (4 * 1024 * 1024)
+#define HOST_FLASH_SECTOR_SIZE 4096
+
+static std::vector<uint8_t>& hostFlash() {
+  static std::vector<uint8_t> flash(HOST_FLASH_SIZE, 0xFF);
+  return flash;
+}
+
+static bool flashPowered() {
+  if (ESP.flashOpsLeft == 0) {
+    return false;
+  }
+  if (ESP.flashOpsLeft > 0) {
+    ESP.flashOpsLeft--;
+  }
+  return true;
+}
+
+bool HostESP::flashEraseSector(uint32_t sector) {
+  size_t offset = (size_t)sector * HOST_FLASH_SECTOR_SIZE;
+  if (offset + HOST_FLASH_SECTOR_SIZE > HOST_FLASH_SIZE || !flashPowered()) {
+    return false;
+  }
+  memset(&hostFlash()[offset], 0xFF, HOST_FLASH_SECTOR_SIZE);
+  flashErases++;
+  return true;
+}
+
+bool HostESP::flashWrite(uint32_t offset, uint32_t* data, size_t size) {
+  if (offset % 4 || size % 4 || offset + size > HOST_FLASH_SIZE ||
+      !flashPowered()) {
+    return false;
+  }
+  const uint8_t* ptr = (const uint8_t*)data;
+  for (size_t i = 0; i < size; i++) {
+    hostFlash()[offset + i] &= ptr[i];
+  }
+  flashWrites++;
+  flashBytesWritten += size;
+  return true;
+}
+
+bool HostESP::flashRead(uint32_t offset, uint32_t* data, size_t size) {
+  if (offset % 4 || size % 4 || offset + size > HOST_FLASH_SIZE) {
+    return false;
+  }
+  memcpy(data, &hostFlash()[offset], size);
+  return true;
+}
+
+//
+// String and IPAddress
+//
+static std::string formatDouble(double value, unsigned char decimals) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+  return buf;
+}
+
+String::String(float value, unsigned char decimals)
+    : buf(formatDouble(value, decimals)) {}
+
+String::String(double value, unsigned char decimals)
+    : buf(formatDouble(value, decimals)) {}
+
+String IPAddress::toString() const {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", address.bytes[0],
+           address.bytes[1], address.bytes[2], address.bytes[3]);
+  return String(buf);
+}
+
+//
+// Heap accounting
+//
+// malloc is interposed rather than operator new so ArduinoJson's document
+// pool, which uses malloc directly, is counted as well.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+HostHeap hostHeap = {0, 0, 0, 0};
+
+static const size_t HOST_HEAP_SIZE = 80 * 1024;
+
+HostHeap hostHeapMark() {
+  hostHeap.peak = hostHeap.inUse;
+  return hostHeap;
+}
+
+uint32_t HostESP::getFreeHeap() {
+  return hostHeap.inUse > HOST_HEAP_SIZE ? 0
+                                         : HOST_HEAP_SIZE - hostHeap.inUse;
+}
+
+static void trackAlloc(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  hostHeap.allocations++;
+  hostHeap.inUse += malloc_usable_size(ptr);
+  if (hostHeap.inUse > hostHeap.peak) {
+    hostHeap.peak = hostHeap.inUse;
+  }
+}
+
+static void trackFree(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  hostHeap.frees++;
+  hostHeap.inUse -= malloc_usable_size(ptr);
+}
+
+extern "C" {
+void* malloc(size_t size) {
+  void* ptr = __libc_malloc(size);
+  trackAlloc(ptr);
+  return ptr;
+}
+
+void* calloc(size_t count, size_t size) {
+  void* ptr = __libc_calloc(count, size);
+  trackAlloc(ptr);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+  trackFree(ptr);
+  void* res = __libc_realloc(ptr, size);
+  trackAlloc(res ? res : ptr);
+  return res;
+}
+
+void free(void* ptr) {
+  trackFree(ptr);
+  __libc_free(ptr);
+}
+}
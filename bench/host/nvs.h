@@ -0,0 +1,91 @@
+#ifndef __HOST_NVS_H__
+#define __HOST_NVS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+
+typedef int esp_err_t;
+typedef uint32_t nvs_handle_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_NVS_INVALID_LENGTH 0x110c
+
+typedef enum {
+  NVS_READONLY,
+  NVS_READWRITE,
+} nvs_open_mode_t;
+
+/**
+ * Host NVS, blobs kept in memory per namespace and key. Every set counts
+ * its bytes as written, like NVS writing a new entry.
+ */
+struct HostNVS {
+  std::map<std::string, std::string> blobs;
+  std::string namespaces[8];
+  uint32_t count = 0;
+  unsigned long bytesWritten = 0;
+  unsigned long commits = 0;
+};
+
+extern HostNVS hostNVS;
+
+inline esp_err_t nvs_open(const char* name,
+                          nvs_open_mode_t mode,
+                          nvs_handle_t* handle) {
+  (void)mode;
+  if (hostNVS.count == 8) {
+    return ESP_FAIL;
+  }
+  hostNVS.namespaces[hostNVS.count] = name;
+  *handle = hostNVS.count++;
+  return ESP_OK;
+}
+
+inline void nvs_close(nvs_handle_t handle) {
+  (void)handle;
+}
+
+inline esp_err_t nvs_get_blob(nvs_handle_t handle,
+                              const char* key,
+                              void* value,
+                              size_t* length) {
+  std::map<std::string, std::string>::const_iterator it =
+      hostNVS.blobs.find(hostNVS.namespaces[handle] + "/" + key);
+  if (it == hostNVS.blobs.end()) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  if (value == NULL) {
+    *length = it->second.size();
+    return ESP_OK;
+  }
+  if (*length < it->second.size()) {
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  memcpy(value, it->second.data(), it->second.size());
+  *length = it->second.size();
+  return ESP_OK;
+}
+
+inline esp_err_t nvs_set_blob(nvs_handle_t handle,
+                              const char* key,
+                              const void* value,
+                              size_t length) {
+  hostNVS.blobs[hostNVS.namespaces[handle] + "/" + key] =
+      std::string((const char*)value, length);
+  hostNVS.bytesWritten += length;
+  return ESP_OK;
+}
+
+inline esp_err_t nvs_commit(nvs_handle_t handle) {
+  (void)handle;
+  hostNVS.commits++;
+  return ESP_OK;
+}
+
+#endif /* __HOST_NVS_H__ */
@@ -0,0 +1,20 @@
+#ifndef __HOST_ROM_CRC_H__
+#define __HOST_ROM_CRC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Host stand-in for the ESP32 ROM CRC routines. The ROM inverts the CRC on
+// the way in and out, so calls can be chained.
+inline uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *buf++;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+#endif /* __HOST_ROM_CRC_H__ */
@@ -65,6 +65,13 @@ void setup() {
     Allow for the stop of ConfigMangers built in
     HTTP server, and start your own.
 
+    To only serve several clients at once, keep the
+    built-in one and call, before begin():
+
+    configManager.setServer([](int port) -> ConfigServer* {
+        return new EventServer(port);
+    });
+
     This example allows HTTP in AP mode, but provides
     a custom HTTP server when in wifi station mode.
 
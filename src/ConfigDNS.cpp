@@ -0,0 +1,148 @@
+#include "ConfigDNS.h"
+
+static const uint16_t DNS_TYPE_A = 1;
+static const uint16_t DNS_TYPE_ANY = 255;
+
+bool PortalDNS::start(uint16_t port, const IPAddress& ip, uint32_t ttl) {
+  const uint8_t record[DNS_ANSWER_SIZE] = {
+      0xC0, DNS_HEADER_SIZE,  // pointer to the question's name
+      0, DNS_TYPE_A,          // type
+      0, 1,                   // class IN
+      (uint8_t)(ttl >> 24), (uint8_t)(ttl >> 16), (uint8_t)(ttl >> 8),
+      (uint8_t)ttl,  // TTL
+      0, 4,          // address length
+      ip[0], ip[1], ip[2], ip[3]};
+  memcpy(answer, record, sizeof(answer));
+
+  running = udp.begin(port) == 1;
+  lastDrain = micros();
+  return running;
+}
+
+void PortalDNS::stop() {
+  if (running) {
+    udp.stop();
+    running = false;
+  }
+}
+
+size_t PortalDNS::drain(size_t maxPackets, unsigned long budgetMicros) {
+  if (!running) {
+    return 0;
+  }
+
+  unsigned long start = micros();
+  size_t count = 0;
+  int size;
+  while (count < maxPackets && (size = udp.parsePacket()) > 0) {
+    unsigned long waited = micros() - lastDrain;
+    if (waited > maxQueueMicros) {
+      maxQueueMicros = waited;
+    }
+    queueMicros += waited;
+    count++;
+
+    // Oversized packets are skipped, the next parsePacket() discards the
+    // rest.
+    size_t length = 0;
+    if ((size_t)size <= sizeof(buffer)) {
+      int n = udp.read(buffer, sizeof(buffer));
+      length = n > 0 ? reply(n) : 0;
+    }
+    if (length == 0) {
+      dropped++;
+    } else {
+      udp.beginPacket(udp.remoteIP(), udp.remotePort());
+      udp.write(buffer, length);
+      if (udp.endPacket()) {
+        answered++;
+      } else {
+        dropped++;
+      }
+    }
+
+    // At least one packet is handled on every call, whatever the budget.
+    if (budgetMicros > 0 && micros() - start >= budgetMicros) {
+      break;
+    }
+  }
+
+  if (count > 0) {
+    batches++;
+    if (count > maxBatch) {
+      maxBatch = count;
+    }
+  }
+  lastDrain = micros();
+  return count;
+}
+
+DNSStats PortalDNS::getStats() {
+  DNSStats stats;
+  stats.answered = answered;
+  stats.dropped = dropped;
+  stats.batches = batches;
+  stats.maxBatch = maxBatch;
+  uint32_t packets = answered + dropped;
+  stats.avgQueueMicros = packets ? queueMicros / packets : 0;
+  stats.maxQueueMicros = maxQueueMicros;
+  return stats;
+}
+
+void PortalDNS::resetStats() {
+  answered = 0;
+  dropped = 0;
+  batches = 0;
+  maxBatch = 0;
+  maxQueueMicros = 0;
+  queueMicros = 0;
+}
+
+// Turns the query in buffer into its reply, returns the reply length or 0
+// when the packet should be dropped.
+size_t PortalDNS::reply(size_t length) {
+  if (length < DNS_HEADER_SIZE) {
+    return 0;
+  }
+
+  // Standard queries with a single question only.
+  bool query = (buffer[2] & 0x80) == 0;
+  uint8_t opcode = (buffer[2] >> 3) & 0x0F;
+  if (!query || opcode != 0 || buffer[4] != 0 || buffer[5] != 1) {
+    return 0;
+  }
+
+  // Walk the labels of the question's name, queries are never compressed.
+  size_t pos = DNS_HEADER_SIZE;
+  while (pos < length && buffer[pos] != 0) {
+    if (buffer[pos] & 0xC0) {
+      return 0;
+    }
+    pos += buffer[pos] + 1;
+  }
+  // The terminating zero, the type and the class.
+  size_t end = pos + 5;
+  if (end > length) {
+    return 0;
+  }
+  uint16_t type = (buffer[pos + 1] << 8) | buffer[pos + 2];
+  bool answers = type == DNS_TYPE_A || type == DNS_TYPE_ANY;
+  if (answers && end + DNS_ANSWER_SIZE > sizeof(buffer)) {
+    return 0;
+  }
+
+  // Keep the ID and the recursion desired flag, an authoritative answer
+  // without errors. Other types get an empty answer, like DNSServer with
+  // the NoError reply code.
+  buffer[2] = 0x84 | (buffer[2] & 0x01);
+  buffer[3] = 0;
+  buffer[6] = 0;
+  buffer[7] = answers ? 1 : 0;
+  memset(buffer + 8, 0, 4);
+
+  if (answers) {
+    memcpy(buffer + end, answer, DNS_ANSWER_SIZE);
+    end += DNS_ANSWER_SIZE;
+  }
+  return end;
+}
@@ -0,0 +1,65 @@
+#ifndef __CONFIGDNS_H__
+#define __CONFIGDNS_H__
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+// Largest query read, longer ones are dropped. Plain DNS over UDP is
+// capped at 512 bytes.
+#ifndef DNS_BUFFER_SIZE
+#define DNS_BUFFER_SIZE 512
+#endif
+
+#define DNS_HEADER_SIZE 12
+#define DNS_ANSWER_SIZE 16
+
+/**
+ * DNS Stats
+ *
+ * The queue time is an upper bound, the time since the previous drain
+ * when the packet was read. UDP carries no arrival time.
+ */
+struct DNSStats {
+  uint32_t answered;
+  uint32_t dropped;  // malformed, oversized or not a query
+  uint32_t batches;  // drains that found at least one packet
+  uint16_t maxBatch;
+  uint32_t avgQueueMicros;
+  uint32_t maxQueueMicros;
+};
+
+/**
+ * Portal DNS
+ *
+ * Answers every A query with one address, for the access point's captive
+ * portal. The answer record is built once in start(), each reply is the
+ * query rewritten in place in a fixed buffer, so nothing is allocated
+ * while serving.
+ */
+class PortalDNS {
+ public:
+  bool start(uint16_t port, const IPAddress& ip, uint32_t ttl = 60);
+  void stop();
+  size_t drain(size_t maxPackets, unsigned long budgetMicros);
+
+  DNSStats getStats();
+  void resetStats();
+
+ private:
+  WiFiUDP udp;
+  uint8_t buffer[DNS_BUFFER_SIZE];
+  uint8_t answer[DNS_ANSWER_SIZE];
+  bool running = false;
+  unsigned long lastDrain = 0;
+
+  uint32_t answered = 0;
+  uint32_t dropped = 0;
+  uint32_t batches = 0;
+  uint16_t maxBatch = 0;
+  uint32_t maxQueueMicros = 0;
+  uint64_t queueMicros = 0;
+
+  size_t reply(size_t length);
+};
+
+#endif /* __CONFIGDNS_H__ */
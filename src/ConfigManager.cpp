@@ -6,16 +6,88 @@ const char magicBytesEmpty[MAGIC_LENGTH] = {'\0', '\0'};
 
 const char mimeHTML[] PROGMEM = "text/html";
 const char mimeJSON[] PROGMEM = "application/json";
+const char mimeMsgPack[] PROGMEM = "application/msgpack";
 const char mimePlain[] PROGMEM = "text/plain";
 const char mimeCSS[] PROGMEM = "text/css";
 const char mimeJS[] PROGMEM = "application/javascript";
 
 bool DEBUG_MODE = false;
 
+static uint32_t hashName(const char* name, size_t length);
+
+// Size of the buffer responses are streamed through.
+#define CHUNK_BUFFER_SIZE 128
+
+/**
+ * Chunked Print
+ *
+ * Buffers writes and sends them to the client as chunks of a chunked
+ * transfer encoded response.
+ */
+class ChunkedPrint : public Print {
+ public:
+  ChunkedPrint(ConfigServer* server) : server(server) {}
+
+  size_t write(uint8_t c) {
+    if (length == CHUNK_BUFFER_SIZE) {
+      flush();
+    }
+    buffer[length++] = c;
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t size) {
+    size_t n = size;
+    while (n > 0) {
+      if (length == CHUNK_BUFFER_SIZE) {
+        flush();
+      }
+      size_t count = min(n, (size_t)CHUNK_BUFFER_SIZE - length);
+      memcpy(buffer + length, data, count);
+      length += count;
+      data += count;
+      n -= count;
+    }
+    return size;
+  }
+
+  void flush() {
+    if (length > 0) {
+      server->sendContent((const char*)buffer, length);
+      length = 0;
+    }
+  }
+
+ private:
+  ConfigServer* server;
+  uint8_t buffer[CHUNK_BUFFER_SIZE];
+  size_t length = 0;
+};
+
+/**
+ * String Print, appends to a String.
+ */
+class StringPrint : public Print {
+ public:
+  StringPrint(String* out) : out(out) {}
+
+  size_t write(uint8_t c) {
+    *out += (char)c;
+    return 1;
+  }
+
+ private:
+  String* out;
+};
+
 //
 // Setup and Loop
 //
 void ConfigManager::setup() {
+  if (!tasksAdded) {
+    addTasks();
+  }
+
   char magic[MAGIC_LENGTH];
   char ssid[SSID_LENGTH];
   char password[PASSWORD_LENGTH];
@@ -23,34 +95,48 @@ void ConfigManager::setup() {
   DebugPrint(F("MAC: "));
   DebugPrintln(WiFi.macAddress());
 
+  buildFilter();
+
   DebugPrintln(F("Checking for magic initialization"));
-  EEPROM.get(0, magic);
+  storage->read(0, magic, MAGIC_LENGTH);
+  loadRegions();
 
   if (memcmp(magic, magicBytes, MAGIC_LENGTH) == 0) {
     DebugPrintln(F("Reading saved configuration"));
     readConfig();
 
-    EEPROM.get(MAGIC_LENGTH, ssid);
+    storage->read(MAGIC_LENGTH, ssid, SSID_LENGTH);
 
     if (strlen(ssid) > 0) {
       DebugPrint(F("SSID: \""));
       DebugPrint(ssid);
       DebugPrintln(F("\""));
 
-      EEPROM.get(MAGIC_LENGTH + SSID_LENGTH, password);
+      if (wifiConnectAsync) {
+        // Return right away, loop() drives the connection from here.
+        this->wifiMode = station;
+        wifiAttempt = 0;
+        wifiBegin();
+        return;
+      }
+
+      storage->read(MAGIC_LENGTH + SSID_LENGTH, password, PASSWORD_LENGTH);
 
       int attempt = 0;
       bool success = false;
 
+      setWifiState(wifiConnecting);
       while (attempt < this->wifiConnectAttempts && !success) {
         attempt++;
         DebugPrintln(F(""));
         DebugPrint(F("Wifi connection attempt "));
         DebugPrintln(attempt);
-        success = wifiConnect(ssid, password);
+        success = wifiConnect(ssid, password, attempt);
       }
 
       if (success) {
+        wifiOnConnected();
+        setWifiState(wifiOnline);
         startApi();
       } else {
         DebugPrintln(F(""));
@@ -76,19 +162,91 @@ void ConfigManager::setup() {
 }
 
 void ConfigManager::loop() {
-  if (this->getMode() == ap) {
-    if (apTimeout > 0 && ((millis() - apStart) / 1000) > (uint16_t)apTimeout) {
-      ESP.restart();
-    }
+  if (!tasksAdded) {
+    addTasks();
+  }
+  scheduler.run();
+}
+
+// The work loop() does, highest priority first. Connection handling goes
+// before serving, housekeeping last.
+void ConfigManager::addTasks() {
+  tasksAdded = true;
 
-    if (dnsServer) {
+  scheduler.add("wifi", 3, 0, [this]() { wifiLoop(); });
+  scheduler.add("dns", 2, 0, [this]() {
+    if (this->getMode() != ap) {
+      return;
+    }
+    if (portalDns) {
+      portalDns->drain(dnsBatch, dnsBudget);
+    } else if (dnsServer) {
       dnsServer->processNextRequest();
     }
+  });
+  scheduler.add("http", 2, 0, [this]() {
+    if (server && this->webserverRunning) {
+      server->handleClient();
+    }
+  });
+  scheduler.add("scan", 1, 0, [this]() { scanLoop(); });
+  scheduler.add("apTimeout", 1, 1000, [this]() {
+    if (this->getMode() == ap && apTimeout > 0 &&
+        ((millis() - apStart) / 1000) > (uint16_t)apTimeout) {
+      flush();
+      ESP.restart();
+    }
+  });
+  scheduler.add("storage", 0, 0, [this]() {
+    regionLoop();
+    flushLoop();
+    storage->loop();
+  });
+}
+
+void ConfigManager::setLoopBudget(unsigned long micros) {
+  scheduler.setBudget(micros);
+}
+
+void ConfigManager::setDNSBatch(size_t maxPackets,
+                                unsigned long budgetMicros) {
+  this->dnsBatch = maxPackets;
+  this->dnsBudget = budgetMicros;
+}
+
+DNSStats ConfigManager::getDNSStats() {
+  if (!portalDns) {
+    DNSStats stats;
+    memset(&stats, 0, sizeof(stats));
+    return stats;
   }
+  return portalDns->getStats();
+}
+
+bool ConfigManager::addTask(const char* name,
+                            uint8_t priority,
+                            unsigned long interval,
+                            std::function<void()> fn) {
+  return scheduler.add(name, priority, interval, fn);
+}
 
-  if (server && this->webserverRunning) {
-    server->handleClient();
+bool ConfigManager::setTaskPriority(const char* name, uint8_t priority) {
+  if (!tasksAdded) {
+    addTasks();
   }
+  return scheduler.setPriority(name, priority);
+}
+
+size_t ConfigManager::getTaskCount() {
+  return scheduler.size();
+}
+
+TaskStats ConfigManager::getTaskStats(size_t index) {
+  return scheduler.getStats(index);
+}
+
+void ConfigManager::resetTaskStats() {
+  scheduler.resetStats();
 }
 
 wifiModes ConfigManager::getMode() {
@@ -116,6 +274,7 @@ void ConfigManager::setAPTimeout(const int timeout) {
 
 void ConfigManager::startAP() {
   this->wifiMode = ap;
+  setWifiState(wifiAccessPoint);
 
   DebugPrintln(F("Starting Access Point"));
 
@@ -137,9 +296,15 @@ void ConfigManager::startAP() {
   DebugPrint("AP IP address: ");
   DebugPrintln(myIP);
 
-  dnsServer.reset(new DNSServer);
-  dnsServer->setErrorReplyCode(DNSReplyCode::NoError);
-  dnsServer->start(DNS_PORT, "*", ip);
+  if (dnsBatch > 0) {
+    portalDns.reset(new PortalDNS);
+    portalDns->start(DNS_PORT, ip);
+  } else {
+    dnsServer.reset(new DNSServer);
+    dnsServer->setErrorReplyCode(DNSReplyCode::NoError);
+    dnsServer->start(DNS_PORT, "*", ip);
+  }
+  preparePortal(ip);
 
   apStart = millis();
 }
@@ -148,26 +313,39 @@ void ConfigManager::startAPApi() {
   DebugPrintln(F("AP Api Mode"));
   createBaseWebServer();
 
-  if (apCallback) {
-    apCallback(server.get());
-  }
+  runServerCallbacks(apCallback, apServerCallback);
 
   this->startWebserver();
 }
 
 void ConfigManager::startApi() {
   DebugPrintln(F("Station Mode"));
+  apiStarted = true;
   createBaseWebServer();
 
   server->on("/settings", HTTPMethod::HTTP_GET,
-             std::bind(&ConfigManager::handleSettingsGetREST, this));
+             timed(routeSettingsGet, &ConfigManager::handleSettingsGetREST));
   server->on("/settings", HTTPMethod::HTTP_PUT,
-             std::bind(&ConfigManager::handleSettingsPutREST, this));
+             timed(routeSettingsPut, &ConfigManager::handleSettingsPutREST));
 
-  if (apiCallback) {
-    apiCallback(server.get());
+  if (schemaPrintSchema) {
+    server->on("/schema", HTTPMethod::HTTP_GET,
+               timed(routeSchema, &ConfigManager::handleSchemaGet));
   }
 
+  for (size_t i = 0; i < regionCount; i++) {
+    if (!regions[i].printJson) {
+      continue;
+    }
+    String uri = String("/settings/") + regions[i].name;
+    server->on(uri, HTTPMethod::HTTP_GET,
+               timed(routeRegionGet, [this, i]() { handleRegionGet(i); }));
+    server->on(uri, HTTPMethod::HTTP_PUT,
+               timed(routeRegionPut, [this, i]() { handleRegionPut(i); }));
+  }
+
+  runServerCallbacks(apiCallback, apiServerCallback);
+
   this->startWebserver();
 }
 
@@ -175,14 +353,161 @@ void ConfigManager::setAPCallback(std::function<void(WebServer*)> callback) {
   this->apCallback = callback;
 }
 
+void ConfigManager::setAPCallback(
+    std::function<void(ConfigServer*)> callback) {
+  this->apServerCallback = callback;
+}
+
 void ConfigManager::setAPICallback(std::function<void(WebServer*)> callback) {
   this->apiCallback = callback;
 }
 
+void ConfigManager::setAPICallback(
+    std::function<void(ConfigServer*)> callback) {
+  this->apiServerCallback = callback;
+}
+
+void ConfigManager::setServer(
+    std::function<ConfigServer*(int port)> factory) {
+  this->serverFactory = factory;
+}
+
+// WebServer callbacks need the synchronous server, other backends only
+// get the ConfigServer ones.
+void ConfigManager::runServerCallbacks(
+    std::function<void(WebServer*)>& callback,
+    std::function<void(ConfigServer*)>& serverCallback) {
+  if (callback) {
+    WebServer* webServer = server->webServer();
+    if (webServer) {
+      callback(webServer);
+    } else {
+      DebugPrintln(F("WebServer callback skipped, the server has none"));
+    }
+  }
+  if (serverCallback) {
+    serverCallback(server.get());
+  }
+}
+
 void ConfigManager::setInitCallback(std::function<void()> callback) {
   this->initCallback = callback;
 }
 
+void ConfigManager::setWifiStateCallback(
+    std::function<void(WifiState)> callback) {
+  this->wifiStateCallback = callback;
+}
+
+//
+// ConfigManager Regions
+//
+bool ConfigManager::addRegionData(
+    const char* name,
+    void* data,
+    size_t size,
+    unsigned long interval,
+    size_t (*printJson)(Print&, const void*, bool&),
+    int (*fromJson)(void*, const char*, JsonVariant, size_t*, size_t*),
+    size_t (*filter)(JsonObject*, size_t*)) {
+  // The layout is fixed once the storage is initialized.
+  if (regionCount == CONFIG_MAX_REGIONS || shadow) {
+    return false;
+  }
+
+  ConfigRegion& region = regions[regionCount++];
+  region.name = name;
+  region.data = data;
+  region.size = size;
+  region.offset = 0;
+  region.interval = interval;
+  region.lastSave = 0;
+  region.dirty = false;
+  region.printJson = printJson;
+  region.fromJson = fromJson;
+  region.filter = filter;
+  region.putCapacity = 0;
+  return true;
+}
+
+bool ConfigManager::saveRegion(const char* name) {
+  int i = regionIndex(name);
+  return i >= 0 && writeRegion(i);
+}
+
+// Saves the region from loop(), once its interval has passed.
+bool ConfigManager::markRegionDirty(const char* name) {
+  int i = regionIndex(name);
+  if (i < 0) {
+    return false;
+  }
+  regions[i].dirty = true;
+  return true;
+}
+
+int ConfigManager::regionIndex(const char* name) {
+  for (size_t i = 0; i < regionCount; i++) {
+    if (strcmp(regions[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+uint32_t ConfigManager::regionKey(size_t index) {
+  ConfigRegion& region = regions[index];
+  return hashName(region.name, strlen(region.name)) ^ region.size;
+}
+
+void ConfigManager::loadRegions() {
+  for (size_t i = 0; i < regionCount; i++) {
+    ConfigRegion& region = regions[i];
+    uint32_t key;
+    storage->read(region.offset - sizeof(key), &key, sizeof(key));
+
+    if (key == regionKey(i)) {
+      storage->read(region.offset, region.data, region.size);
+      continue;
+    }
+
+    // New or resized, the initial values go out with the next commit.
+    key = regionKey(i);
+    writeImage(region.offset - sizeof(key), &key, sizeof(key));
+    writeImage(region.offset, region.data, region.size);
+  }
+}
+
+// Only the bytes of the region that changed are written, the rest of the
+// image is left alone.
+bool ConfigManager::writeRegion(size_t index) {
+  ConfigRegion& region = regions[index];
+  region.dirty = false;
+  region.lastSave = millis();
+
+  writeImage(region.offset, region.data, region.size);
+
+  // A cold start has no magic in the image yet. The region goes out with
+  // the config and the magic in one commit, the way save() writes them, so
+  // the stored image is never a region next to an unmarked config.
+  char magic[MAGIC_LENGTH];
+  storage->read(0, magic, MAGIC_LENGTH);
+  if (memcmp(magic, magicBytes, MAGIC_LENGTH) != 0) {
+    writeImage(CONFIG_OFFSET, config, configSize);
+    return commitChanges();
+  }
+  return dirtyCount > 0 && requestCommit();
+}
+
+void ConfigManager::regionLoop() {
+  unsigned long now = millis();
+  for (size_t i = 0; i < regionCount; i++) {
+    ConfigRegion& region = regions[i];
+    if (region.dirty && now - region.lastSave >= region.interval) {
+      writeRegion(i);
+    }
+  }
+}
+
 //
 // ConfigManager Wifi Utilitiees
 //
@@ -198,17 +523,202 @@ void ConfigManager::setWifiConnectInterval(const int interval) {
   this->wifiConnectInterval = interval;
 }
 
+void ConfigManager::setWifiConnectAsync(bool async) {
+  this->wifiConnectAsync = async;
+}
+
+void ConfigManager::setWifiFastConnect(bool enabled, bool staticIP) {
+  this->wifiFastConnect = enabled;
+  this->wifiStaticIP = staticIP;
+}
+
+unsigned long ConfigManager::getWifiConnectTime() {
+  return wifiConnectTime;
+}
+
+WifiState ConfigManager::getWifiState() {
+  return wifiState;
+}
+
+void ConfigManager::setWifiState(WifiState state) {
+  wifiStateStart = millis();
+  if (state == wifiState) {
+    return;
+  }
+
+  wifiState = state;
+  if (wifiStateCallback) {
+    wifiStateCallback(state);
+  }
+}
+
+void ConfigManager::wifiBegin() {
+  char ssid[SSID_LENGTH];
+  char password[PASSWORD_LENGTH];
+
+  storage->read(MAGIC_LENGTH, ssid, SSID_LENGTH);
+  storage->read(MAGIC_LENGTH + SSID_LENGTH, password, PASSWORD_LENGTH);
+
+  wifiAttempt++;
+  DebugPrint(F("Wifi connection attempt "));
+  DebugPrintln(wifiAttempt);
+
+  WiFi.mode(WIFI_STA);
+  wifiStart(ssid, password, wifiAttempt);
+  setWifiState(wifiConnecting);
+}
+
+// Starts a connection attempt. The first attempt of a connection goes
+// straight to the cached access point, later ones take the full path.
+void ConfigManager::wifiStart(const char* ssid,
+                              const char* password,
+                              int attempt) {
+  WifiCache cache;
+  bool fast = wifiFastConnect && attempt == 1 && readWifiCache(ssid, &cache);
+
+  if (attempt == 1) {
+    wifiConnectStart = millis();
+  }
+  if (metrics) {
+    metrics->wifiAttempts++;
+  }
+
+  if (fast && wifiStaticIP) {
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway),
+                IPAddress(cache.mask), IPAddress(cache.dns));
+    wifiStaticApplied = true;
+  } else if (wifiStaticApplied) {
+    // The cached lease did not work out, go back to DHCP.
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0),
+                IPAddress((uint32_t)0));
+    wifiStaticApplied = false;
+  }
+
+  if (fast) {
+    DebugPrintln(F("Connecting to the cached access point"));
+    WiFi.begin(ssid, password[0] == '\0' ? NULL : password, cache.channel,
+               cache.bssid);
+  } else {
+    WiFi.begin(ssid, password[0] == '\0' ? NULL : password);
+  }
+}
+
+void ConfigManager::wifiOnConnected() {
+  wifiConnectTime = millis() - wifiConnectStart;
+  DebugPrint(F("Connected in "));
+  DebugPrint(wifiConnectTime);
+  DebugPrintln(F("ms"));
+  preparePortal(WiFi.localIP());
+
+  if (!wifiFastConnect) {
+    return;
+  }
+
+  char ssid[SSID_LENGTH];
+  storage->read(MAGIC_LENGTH, ssid, SSID_LENGTH);
+
+  WifiCache cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.key = hashName(ssid, strnlen(ssid, SSID_LENGTH));
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.ip = (uint32_t)WiFi.localIP();
+  cache.gateway = (uint32_t)WiFi.gatewayIP();
+  cache.mask = (uint32_t)WiFi.subnetMask();
+  cache.dns = (uint32_t)WiFi.dnsIP();
+
+  // Only commits when the network or the lease changed.
+  writeImage(wifiCacheOffset(), &cache, sizeof(cache));
+  requestCommit();
+}
+
+size_t ConfigManager::wifiCacheOffset() {
+  return CONFIG_OFFSET + configSize + GENERATION_LENGTH;
+}
+
+bool ConfigManager::readWifiCache(const char* ssid, WifiCache* cache) {
+  if (!memoryInitialized) {
+    return false;
+  }
+
+  storage->read(wifiCacheOffset(), cache, sizeof(WifiCache));
+  return cache->key == hashName(ssid, strnlen(ssid, SSID_LENGTH)) &&
+         cache->channel > 0 && cache->ip != 0;
+}
+
+// Advances the connection without blocking. Also reconnects a station that
+// lost its connection, whether it connected asynchronously or not.
+void ConfigManager::wifiLoop() {
+  unsigned long elapsed = millis() - wifiStateStart;
+
+  switch (wifiState) {
+    case wifiConnecting:
+      if (wifiConnected()) {
+        DebugPrint(F("Connected with "));
+        DebugPrintln(WiFi.localIP());
+        wifiAttempt = 0;
+        wifiOnConnected();
+        setWifiState(wifiOnline);
+        if (!apiStarted) {
+          startApi();
+        }
+      } else if (elapsed >= (unsigned long)wifiConnectRetries *
+                                wifiConnectInterval) {
+        if (!apiStarted && wifiAttempt >= wifiConnectAttempts) {
+          // Never connected since boot, the credentials may be wrong.
+          DebugPrintln(F("Wifi connection could not be established"));
+          startAP();
+          startAPApi();
+        } else {
+          setWifiState(wifiBackoff);
+        }
+      }
+      break;
+
+    case wifiBackoff:
+      if (wifiConnected()) {
+        wifiAttempt = 0;
+        wifiOnConnected();
+        setWifiState(wifiOnline);
+      } else if (elapsed >= wifiBackoffDelay()) {
+        wifiBegin();
+      }
+      break;
+
+    case wifiOnline:
+      if (!wifiConnected()) {
+        DebugPrintln(F("Wifi connection lost"));
+        if (metrics) {
+          metrics->wifiReconnects++;
+        }
+        wifiAttempt = 0;
+        setWifiState(wifiBackoff);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// Doubles the wait after each failed attempt, up to WIFI_BACKOFF_MAX.
+unsigned long ConfigManager::wifiBackoffDelay() {
+  int shift = wifiAttempt < 8 ? wifiAttempt : 8;
+  unsigned long wait = (unsigned long)wifiConnectInterval << shift;
+  return wait < WIFI_BACKOFF_MAX ? wait : WIFI_BACKOFF_MAX;
+}
+
 bool ConfigManager::wifiConnected() {
   return WiFi.status() == WL_CONNECTED;
 }
 
-bool ConfigManager::wifiConnect(char* ssid, char* password) {
+bool ConfigManager::wifiConnect(char* ssid, char* password, int attempt) {
   DebugPrintln(F("Waiting for WiFi to connect"));
 
   bool connected = false;
   int retry = 0;
 
-  WiFi.begin(ssid, password[0] == '\0' ? NULL : password);
+  wifiStart(ssid, password, attempt);
 
   while (retry < this->wifiConnectRetries && !connected) {
     DebugPrint(F("."));
@@ -251,11 +761,17 @@ void ConfigManager::storeWifiSettings(String ssid, String password) {
   DebugPrint(ssidChar);
   DebugPrintln(F("\""));
 
-  EEPROM.put(MAGIC_LENGTH, ssidChar);
-  EEPROM.put(MAGIC_LENGTH + SSID_LENGTH, passwordChar);
+  writeImage(MAGIC_LENGTH, ssidChar, SSID_LENGTH);
+  writeImage(MAGIC_LENGTH + SSID_LENGTH, passwordChar, PASSWORD_LENGTH);
+
+  // The cached network belongs to the old credentials.
+  WifiCache cache;
+  memset(&cache, 0, sizeof(cache));
+  writeImage(wifiCacheOffset(), &cache, sizeof(cache));
+
   bool wroteChange = this->commitChanges();
 
-  DebugPrint(F("EEPROM committed: "));
+  DebugPrint(F("Storage committed: "));
   DebugPrintln(wroteChange ? F("true") : F("false"));
 }
 
@@ -274,79 +790,218 @@ void ConfigManager::clearWifiSettings(bool reboot) {
 }
 
 String ConfigManager::scanNetworks() {
-  DynamicJsonDocument doc(1024);
-  JsonArray jsonArray = doc.createNestedArray();
+  if (!scanFresh()) {
+    // Callers of this expect results, wait for the scan to finish.
+    startScan();
+    while (scanRunning) {
+      delay(10);
+      scanLoop();
+    }
+  }
 
-  DebugPrintln("Scanning WiFi networks...");
-  int n = WiFi.scanNetworks();
-  DebugPrintln("scan complete");
-  if (n == 0) {
-    DebugPrintln("no networks found");
-  } else {
-    DebugPrint(n);
-    DebugPrintln(" networks found:");
+  String json;
+  json.reserve(scanCount * 56 + 2);
+  StringPrint out(&json);
+  printScan(out);
+  return json;
+}
 
-    for (int i = 0; i < n; ++i) {
-      String ssid = WiFi.SSID(i);
-      int rssi = WiFi.RSSI(i);
-      String security =
-          WiFi.encryptionType(i) == WIFI_OPEN ? "none" : "enabled";
+size_t ConfigManager::printScan(Print& out) {
+  size_t n = out.print('[');
 
-      DebugPrint("Name: ");
-      DebugPrint(ssid);
-      DebugPrint(" - Strength: ");
-      DebugPrint(rssi);
-      DebugPrint(" - Security: ");
-      DebugPrintln(security);
+  for (size_t i = 0; i < scanCount; i++) {
+    if (i > 0) {
+      n += out.print(',');
+    }
+
+    // The document only references the SSID, it is not copied.
+    StaticJsonDocument<JSON_OBJECT_SIZE(3)> doc;
+    doc["ssid"] = (const char*)scanResults[i].ssid;
+    doc["strength"] = scanResults[i].rssi;
+    doc["security"] = scanResults[i].secure;
+    n += serializeJson(doc, out);
+  }
+
+  return n + out.print(']');
+}
+
+void ConfigManager::setScanMaxAge(int seconds) {
+  this->scanMaxAge = seconds;
+}
+
+bool ConfigManager::scanFresh() {
+  return scanValid &&
+         millis() - scanFinished < (unsigned long)scanMaxAge * 1000;
+}
+
+void ConfigManager::startScan() {
+  if (scanRunning) {
+    return;
+  }
+
+  DebugPrintln(F("Scanning WiFi networks in the background"));
+  int n = WiFi.scanNetworks(true);
+  if (n >= 0) {
+    // Some cores finish right away when results are at hand.
+    collectScan(n);
+    return;
+  }
+  scanRunning = n == WIFI_SCAN_RUNNING;
+}
+
+void ConfigManager::scanLoop() {
+  if (!scanRunning) {
+    return;
+  }
+
+  int n = WiFi.scanComplete();
+  if (n == WIFI_SCAN_RUNNING) {
+    return;
+  }
+
+  scanRunning = false;
+  if (n < 0) {
+    DebugPrintln(F("Scan failed"));
+    return;
+  }
+  collectScan(n);
+}
+
+// Keeps the strongest access point of each SSID, sorted by signal.
+void ConfigManager::collectScan(int count) {
+  DebugPrint(count);
+  DebugPrintln(F(" networks found"));
+
+  if (count > 0 && (size_t)count > scanCapacity) {
+    scanResults.reset(new ScanResult[count]);
+    scanCapacity = count;
+  }
+  scanCount = 0;
+
+  for (int i = 0; i < count; i++) {
+    String ssid = WiFi.SSID(i);
+    if (ssid.length() == 0) {
+      continue;  // hidden networks can not be picked
+    }
+
+    int8_t rssi = WiFi.RSSI(i);
+    bool secure = WiFi.encryptionType(i) != WIFI_OPEN;
+
+    size_t j = 0;
+    while (j < scanCount && strcmp(scanResults[j].ssid, ssid.c_str()) != 0) {
+      j++;
+    }
+
+    if (j == scanCount) {
+      strncpy(scanResults[j].ssid, ssid.c_str(), SSID_LENGTH);
+      scanResults[j].ssid[SSID_LENGTH] = '\0';
+      scanCount++;
+    } else if (rssi <= scanResults[j].rssi) {
+      continue;
+    }
+    scanResults[j].rssi = rssi;
+    scanResults[j].secure = secure;
+  }
 
-      JsonObject obj = doc.createNestedObject();
-      obj["ssid"] = ssid;
-      obj["strength"] = rssi;
-      obj["security"] = security == "none" ? false : true;
-      jsonArray.add(obj);
+  for (size_t i = 1; i < scanCount; i++) {
+    ScanResult result = scanResults[i];
+    size_t j = i;
+    for (; j > 0 && scanResults[j - 1].rssi < result.rssi; j--) {
+      scanResults[j] = scanResults[j - 1];
     }
+    scanResults[j] = result;
   }
 
-  String jsonSerialized;
-  serializeJson(jsonArray, jsonSerialized);
-  return jsonSerialized;
+  WiFi.scanDelete();
+  scanFinished = millis();
+  scanValid = true;
 }
 
 //
 // ConfigManager Config Utilities
 //
-JsonObject ConfigManager::decodeJson(String jsonString) {
-  DynamicJsonDocument doc(1024);
-
+// Parses into a document owned by the caller, so the result outlives the
+// call.
+bool ConfigManager::decodeJson(const String& jsonString,
+                               JsonDocument& doc,
+                               JsonDocument& filter) {
   if (jsonString.length() == 0) {
-    return doc.as<JsonObject>();
+    return false;
   }
 
-  auto error = deserializeJson(doc, jsonString);
+  auto error = deserializeJson(doc, jsonString,
+                               DeserializationOption::Filter(filter));
   if (error) {
     DebugPrint(F("deserializeJson() failed with code "));
     DebugPrintln(error.c_str());
-    return doc.as<JsonObject>();
+    return false;
+  }
+
+  return true;
+}
+
+// Builds the filter PUT /settings bodies are parsed with and sizes the
+// document for the largest body that only holds known keys.
+void ConfigManager::buildFilter() {
+  size_t count = 0;
+  size_t bytes = 0;
+
+  for (size_t i = 0; i < parameters.size(); i++) {
+    BaseParameter* param = parameters[i];
+    if (param->getMode() != get) {
+      count++;
+      // The parameter size bounds the string a value is parsed into.
+      bytes += strlen(param->getName()) + 1 + param->getSize();
+    }
+  }
+  if (schemaFilter) {
+    bytes += schemaFilter(NULL, &count);
+  }
+
+  putCapacity = JSON_OBJECT_SIZE(count) + bytes;
+  filterParameters = parameters.size();
+
+  putFilter.reset(new DynamicJsonDocument(JSON_OBJECT_SIZE(count) + bytes));
+  JsonObject filter = putFilter->to<JsonObject>();
+  for (size_t i = 0; i < parameters.size(); i++) {
+    if (parameters[i]->getMode() != get) {
+      filter[parameters[i]->getName()] = true;
+    }
+  }
+  if (schemaFilter) {
+    schemaFilter(&filter, &count);
   }
+  putFilter->shrinkToFit();
+}
 
-  return doc.as<JsonObject>();
+// The filter and document size of a region's PUT bodies, from its schema.
+void ConfigManager::buildRegionFilter(size_t index) {
+  ConfigRegion& region = regions[index];
+  size_t count = 0;
+  size_t bytes = region.filter(NULL, &count);
+  region.putCapacity = JSON_OBJECT_SIZE(count) + bytes;
+
+  regionFilters[index].reset(new DynamicJsonDocument(region.putCapacity));
+  JsonObject filter = regionFilters[index]->to<JsonObject>();
+  region.filter(&filter, &count);
+  regionFilters[index]->shrinkToFit();
 }
 
 void ConfigManager::clearAllSettings(bool reboot) {
   this->clearSettings(false);
   this->clearWifiSettings(false);
-  EEPROM.put(0, magicBytesEmpty);
-  EEPROM.commit();
+  writeImage(0, magicBytesEmpty, MAGIC_LENGTH);
+  requestCommit();
   if (reboot) {
+    flush();
     ESP.restart();
   }
 }
 
 void ConfigManager::readConfig() {
-  byte* ptr = (byte*)config;
-
-  for (int i = 0; i < (int16_t)configSize; i++) {
-    *(ptr++) = EEPROM.read(CONFIG_OFFSET + i);
+  // A mapped config already is the stored image.
+  if (!mappedImage) {
+    storage->read(CONFIG_OFFSET, config, configSize);
   }
 }
 
@@ -354,67 +1009,754 @@ JsonObject ConfigManager::asJson() {
   DynamicJsonDocument doc(1024);
   JsonObject obj = doc.createNestedObject();
 
-  std::list<BaseParameter*>::iterator it;
-  for (it = parameters.begin(); it != parameters.end(); ++it) {
-    if ((*it)->getMode() == set) {
+  for (size_t i = 0; i < parameters.size(); i++) {
+    if (parameters[i]->getMode() == set) {
       continue;
     }
 
-    (*it)->toJson(&obj);
+    parameters[i]->toJson(&obj);
   }
 
   return obj;
 }
 
-bool ConfigManager::commitChanges() {
-  EEPROM.put(0, magicBytes);
-  return EEPROM.commit();
-}
+size_t ConfigManager::printJson(Print& out) {
+  StaticJsonDocument<16> key;
+  size_t n = out.print('{');
+  bool first = true;
 
-void ConfigManager::writeConfig() {
-  byte* ptr = (byte*)config;
+  if (schemaPrintJson) {
+    n += schemaPrintJson(out, config, first);
+  }
+
+  for (size_t i = 0; i < parameters.size(); i++) {
+    if (parameters[i]->getMode() == set) {
+      continue;
+    }
+
+    if (!first) {
+      n += out.print(',');
+    }
+    first = false;
 
-  for (int i = 0; i < (int16_t)configSize; i++) {
-    EEPROM.write(CONFIG_OFFSET + i, *(ptr++));
+    key.set(parameters[i]->getName());
+    n += serializeJson(key, out);
+    n += out.print(':');
+    n += parameters[i]->printJson(out);
   }
-  this->commitChanges();
-}
 
-void ConfigManager::save() {
-  this->writeConfig();
+  return n + out.print('}');
 }
 
-void ConfigManager::updateFromJson(JsonObject obj) {
-  std::list<BaseParameter*>::iterator it;
-  for (it = parameters.begin(); it != parameters.end(); ++it) {
-    if ((*it)->getMode() == get) {
+size_t ConfigManager::printMsgPack(Print& out) {
+  StaticJsonDocument<16> key;
+  size_t count = schemaReadable ? schemaReadable() : 0;
+  for (size_t i = 0; i < parameters.size(); i++) {
+    if (parameters[i]->getMode() != set) {
+      count++;
+    }
+  }
+
+  // The map header needs the entry count up front.
+  size_t n;
+  if (count < 16) {
+    n = out.write((uint8_t)(0x80 | count));
+  } else {
+    n = out.write((uint8_t)0xDE);
+    n += out.write((uint8_t)(count >> 8));
+    n += out.write((uint8_t)count);
+  }
+
+  if (schemaPrintMsgPack) {
+    n += schemaPrintMsgPack(out, config);
+  }
+
+  for (size_t i = 0; i < parameters.size(); i++) {
+    if (parameters[i]->getMode() == set) {
       continue;
     }
 
-    (*it)->fromJson(&obj);
+    key.set(parameters[i]->getName());
+    n += serializeMsgPack(key, out);
+    n += parameters[i]->printMsgPack(out);
   }
 
-  writeConfig();
+  return n;
 }
 
-void ConfigManager::clearSettings(bool reboot) {
-  DebugPrintln(F("Clearing Settings...."));
-  std::list<BaseParameter*>::iterator it;
-  for (it = parameters.begin(); it != parameters.end(); ++it) {
-    (*it)->clearData();
+bool ConfigManager::initStorage() {
+  shadowSize = CONFIG_OFFSET + configSize + GENERATION_LENGTH +
+               sizeof(WifiCache);
+
+  // Regions follow, each behind its key.
+  for (size_t i = 0; i < regionCount; i++) {
+    regions[i].offset = shadowSize + sizeof(uint32_t);
+    shadowSize = regions[i].offset + regions[i].size;
+  }
+  if (!storage->begin(shadowSize)) {
+    DebugPrintln(F("Storage could not be initialized"));
+    return false;
   }
 
-  writeConfig();
+  shadow.reset(new uint8_t[shadowSize]);
+  storage->read(0, shadow.get(), shadowSize);
+  dirtyCount = 0;
+  readGeneration();
+  return true;
+}
 
-  if (reboot) {
-    ESP.restart();
+bool ConfigManager::mapConfig() {
+  this->memoryInitialized = this->initStorage();
+  this->mappedImage = memoryInitialized ? storage->data() : NULL;
+  if (!mappedImage) {
+    DebugPrintln(F("Storage has no image to map"));
+    return false;
+  }
+
+  this->config = mappedImage + CONFIG_OFFSET;
+  if (memcmp(mappedImage, magicBytes, MAGIC_LENGTH) != 0) {
+    // Cold start, start from zeros rather than erased bytes.
+    memset(config, 0, configSize);
   }
+  return true;
 }
 
-//
-// ConfigManager HTTP Utilities
-//
-void ConfigManager::startWebserver() {
+void ConfigManager::writeImage(size_t offset,
+                               const void* data,
+                               size_t length) {
+  if (!shadow || offset + length > shadowSize) {
+    return;
+  }
+
+  if (!mappedImage || data != mappedImage + offset) {
+    storage->write(offset, data, length);
+  }
+
+  // Track the byte ranges that differ from the last committed image.
+  const uint8_t* ptr = (const uint8_t*)data;
+  for (size_t i = 0; i < length; i++) {
+    if (shadow[offset + i] != ptr[i]) {
+      markDirty(offset + i);
+    }
+  }
+}
+
+void ConfigManager::markDirty(size_t address) {
+  for (size_t i = 0; i < dirtyCount; i++) {
+    if (address + 1 >= dirty[i].start && address <= dirty[i].end) {
+      dirty[i].start = min(dirty[i].start, address);
+      dirty[i].end = max(dirty[i].end, address + 1);
+      return;
+    }
+  }
+
+  if (dirtyCount < STORAGE_MAX_RANGES) {
+    dirty[dirtyCount].start = address;
+    dirty[dirtyCount].end = address + 1;
+    dirtyCount++;
+    return;
+  }
+
+  // Out of ranges, grow the closest one over the gap.
+  size_t best = 0;
+  size_t bestGap = (size_t)-1;
+  for (size_t i = 0; i < dirtyCount; i++) {
+    size_t gap = address < dirty[i].start ? dirty[i].start - address
+                                          : address - dirty[i].end;
+    if (gap < bestGap) {
+      best = i;
+      bestGap = gap;
+    }
+  }
+  dirty[best].start = min(dirty[best].start, address);
+  dirty[best].end = max(dirty[best].end, address + 1);
+}
+
+// Sorts the dirty ranges and joins the ones that touch or nearly touch,
+// a record header costs more than a few unchanged bytes.
+void ConfigManager::mergeDirty() {
+  for (size_t i = 1; i < dirtyCount; i++) {
+    StorageRange range = dirty[i];
+    size_t j = i;
+    for (; j > 0 && dirty[j - 1].start > range.start; j--) {
+      dirty[j] = dirty[j - 1];
+    }
+    dirty[j] = range;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < dirtyCount; i++) {
+    if (n > 0 && dirty[i].start <= dirty[n - 1].end + 16) {
+      dirty[n - 1].end = max(dirty[n - 1].end, dirty[i].end);
+    } else {
+      dirty[n++] = dirty[i];
+    }
+  }
+  dirtyCount = n;
+}
+
+bool ConfigManager::commitImage() {
+  uint8_t chunk[32];
+  size_t changed = 0;
+
+  for (size_t r = 0; r < dirtyCount; r++) {
+    for (size_t i = dirty[r].start; i < dirty[r].end; i += sizeof(chunk)) {
+      size_t n = min(sizeof(chunk), dirty[r].end - i);
+      storage->read(i, chunk, n);
+      for (size_t j = 0; j < n; j++) {
+        if (chunk[j] != shadow[i + j]) {
+          changed++;
+        }
+      }
+    }
+  }
+
+  if (changed == 0) {
+    // Bytes written back to their committed values, nothing to persist.
+    dirtyCount = 0;
+    commitStats.skipped++;
+    return false;
+  }
+
+  mergeDirty();
+  unsigned long start = micros();
+  bool committed = storage->commit(dirty, dirtyCount);
+  if (metrics) {
+    metrics->commits.observe(micros() - start);
+  }
+  if (!committed) {
+    DebugPrintln(F("Storage commit failed"));
+    return false;
+  }
+
+  for (size_t r = 0; r < dirtyCount; r++) {
+    storage->read(dirty[r].start, shadow.get() + dirty[r].start,
+                  dirty[r].end - dirty[r].start);
+  }
+  dirtyCount = 0;
+  readGeneration();
+  commitStats.performed++;
+  commitStats.bytesChanged += changed;
+  return true;
+}
+
+// The generation as last committed.
+void ConfigManager::readGeneration() {
+  memcpy(&generation, shadow.get() + CONFIG_OFFSET + configSize,
+         GENERATION_LENGTH);
+  // Erased storage reads back as all ones, start counting from zero.
+  if (generation == 0xFFFFFFFF) {
+    generation = 0;
+  }
+}
+
+bool ConfigManager::commitChanges() {
+  writeImage(0, magicBytes, MAGIC_LENGTH);
+
+  // Any persisted change moves the generation, and with it the ETag. The
+  // next generation goes out with the changes and only becomes current once
+  // they are committed, a failed or deferred commit writes the same one.
+  if (dirtyCount > 0 || generationPending) {
+    uint32_t next = generation + 1;
+    writeImage(CONFIG_OFFSET + configSize, &next, GENERATION_LENGTH);
+  }
+  generationPending = false;
+
+  return requestCommit();
+}
+
+// Commits now, or queues the commit for the storage task when commits are
+// deferred. Returns true when a commit was made or queued.
+bool ConfigManager::requestCommit() {
+  if (commitMaxDelay == 0) {
+    return commitImage();
+  }
+  if (dirtyCount == 0) {
+    return commitQueued;
+  }
+
+  unsigned long now = millis();
+  if (!commitQueued) {
+    commitQueued = true;
+    commitFirstDirty = now;
+  }
+  commitLastDirty = now;
+  return true;
+}
+
+void ConfigManager::flushLoop() {
+  if (!commitQueued) {
+    return;
+  }
+
+  unsigned long now = millis();
+  if (now - commitLastDirty < commitQuiet &&
+      now - commitFirstDirty < commitMaxDelay) {
+    return;
+  }
+  // The rate cap wins over the maximum delay, it protects the flash.
+  if (commitInterval > 0 && commitStats.performed > 0 &&
+      now - commitLast < commitInterval) {
+    return;
+  }
+
+  if (!flush() && commitQueued) {
+    // Failed, wait a full quiet period before trying again.
+    commitFirstDirty = commitLastDirty = millis();
+  }
+}
+
+void ConfigManager::setCommitDelay(unsigned long quietMillis,
+                                   unsigned long maxMillis) {
+  this->commitQuiet = quietMillis;
+  this->commitMaxDelay = max(quietMillis, maxMillis);
+  if (commitMaxDelay == 0) {
+    flush();
+  }
+}
+
+void ConfigManager::setCommitInterval(unsigned long interval) {
+  this->commitInterval = interval;
+}
+
+bool ConfigManager::flush() {
+  if (!commitQueued) {
+    return false;
+  }
+
+  bool committed = commitImage();
+  commitQueued = dirtyCount > 0;
+  if (committed) {
+    commitLast = millis();
+  }
+  return committed;
+}
+
+bool ConfigManager::commitPending() {
+  return commitQueued;
+}
+
+void ConfigManager::writeConfig() {
+  writeImage(CONFIG_OFFSET, config, configSize);
+  this->commitChanges();
+}
+
+CommitStats ConfigManager::getCommitStats() {
+  return commitStats;
+}
+
+uint32_t ConfigManager::getGeneration() {
+  return generation;
+}
+
+void ConfigManager::save() {
+  // Find what changed since the last write, only when someone listens.
+  if (hasObservers() && config) {
+    parameters.clearChanges();
+    diffParameters();
+    diffFields();
+  }
+
+  this->writeConfig();
+  notifyChanges();
+}
+
+ParameterChanges ConfigManager::updateFromJson(JsonObject obj) {
+  parameters.clearChanges();
+  clearFieldChanges();
+
+  // Walk the keys that were sent, not every registered parameter.
+  for (JsonPair kv : obj) {
+    const char* key = kv.key().c_str();
+    int i = parameters.indexOf(key, strlen(key));
+    if (i < 0) {
+      size_t offset;
+      size_t size;
+      if (schemaFromJson &&
+          schemaFromJson(config, key, kv.value(), &offset, &size) > 0) {
+        writeImage(CONFIG_OFFSET + offset, (uint8_t*)config + offset, size);
+        markFieldChanged(offset);
+      }
+      continue;
+    }
+
+    BaseParameter* param = parameters[i];
+    if (param->getMode() == get || !param->fromJson(kv.value())) {
+      continue;
+    }
+
+    parameters.markChanged(i);
+    writeParameter(param);
+  }
+
+  if (parameters.changeCount() + fieldChangeCount > 0) {
+    // Parameters outside the config struct change the ETag too.
+    generationPending = true;
+    commitChanges();
+    notifyChanges();
+  }
+
+  return ParameterChanges(&parameters, fieldChanges.get(), fieldChangeCount);
+}
+
+void ConfigManager::writeParameter(BaseParameter* param) {
+  // Only parameters that live in the config struct are persisted.
+  int offset = configOffset(param);
+  if (offset < 0) {
+    return;
+  }
+
+  writeImage(CONFIG_OFFSET + offset, param->getData(), param->getSize());
+}
+
+// Offset of the parameter in the config struct, -1 when it lives outside.
+int ConfigManager::configOffset(BaseParameter* param) {
+  const uint8_t* data = (const uint8_t*)param->getData();
+  const uint8_t* base = (const uint8_t*)config;
+
+  if (!config || data < base || data + param->getSize() > base + configSize) {
+    return -1;
+  }
+  return data - base;
+}
+
+bool ConfigManager::imageDiffers(size_t offset,
+                                 const void* data,
+                                 size_t length) {
+  const uint8_t* ptr = (const uint8_t*)data;
+  uint8_t chunk[32];
+
+  // A mapped config is the image, only the last commit tells what changed.
+  if (mappedImage) {
+    return memcmp(shadow.get() + offset, ptr, length) != 0;
+  }
+
+  for (size_t i = 0; i < length; i += sizeof(chunk)) {
+    size_t n = min(sizeof(chunk), length - i);
+    storage->read(offset + i, chunk, n);
+    if (memcmp(chunk, ptr + i, n) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ConfigManager::setChangeCallback(
+    std::function<void(ParameterChanges)> callback) {
+  this->changeCallback = callback;
+}
+
+bool ConfigManager::addChangeObserver(
+    const char* name,
+    std::function<void(const char*)> callback) {
+  if (observerCount == CONFIG_MAX_OBSERVERS) {
+    return false;
+  }
+
+  observers[observerCount].name = name;
+  observers[observerCount].callback = callback;
+  observerCount++;
+  return true;
+}
+
+bool ConfigManager::hasObservers() {
+  return observerCount > 0 || changeCallback;
+}
+
+void ConfigManager::clearFieldChanges() {
+  fieldChangeCount = 0;
+  if (!schemaField || !config || fieldChanges) {
+    return;
+  }
+
+  const char* name;
+  size_t offset;
+  size_t size;
+  while (schemaField(config, fieldCount, &name, &offset, &size)) {
+    fieldCount++;
+  }
+  fieldChanges.reset(new const char*[fieldCount]);
+}
+
+// Records the schema field at offset, once per update.
+void ConfigManager::markFieldChanged(size_t offset) {
+  const char* name;
+  size_t fieldOffset;
+  size_t size;
+  for (size_t i = 0; i < fieldCount; i++) {
+    schemaField(config, i, &name, &fieldOffset, &size);
+    if (fieldOffset != offset) {
+      continue;
+    }
+    for (size_t j = 0; j < fieldChangeCount; j++) {
+      if (fieldChanges[j] == name) {
+        return;
+      }
+    }
+    fieldChanges[fieldChangeCount++] = name;
+    return;
+  }
+}
+
+// Finds the schema fields that differ from the stored image. Bytes that
+// belong to a parameter are already counted by the registry.
+// Marks the parameters in the config struct that differ from the image.
+void ConfigManager::diffParameters() {
+  for (size_t i = 0; i < parameters.size(); i++) {
+    int offset = configOffset(parameters[i]);
+    if (offset >= 0 &&
+        imageDiffers(CONFIG_OFFSET + offset, parameters[i]->getData(),
+                     parameters[i]->getSize())) {
+      parameters.markChanged(i);
+    }
+  }
+}
+
+void ConfigManager::diffFields() {
+  clearFieldChanges();
+
+  const char* name;
+  size_t offset;
+  size_t size;
+  for (size_t i = 0; i < fieldCount; i++) {
+    schemaField(config, i, &name, &offset, &size);
+
+    bool owned = false;
+    for (size_t j = 0; j < parameters.size() && !owned; j++) {
+      int start = configOffset(parameters[j]);
+      owned = start >= 0 && (size_t)start < offset + size &&
+              offset < start + parameters[j]->getSize();
+    }
+    if (!owned &&
+        imageDiffers(CONFIG_OFFSET + offset, (uint8_t*)config + offset,
+                     size)) {
+      fieldChanges[fieldChangeCount++] = name;
+    }
+  }
+}
+
+// One notification per update, after the changes are written. Changes made
+// from inside a callback do not notify again.
+void ConfigManager::notifyChanges() {
+  if (notifying || !hasObservers()) {
+    return;
+  }
+
+  ParameterChanges changes(&parameters, fieldChanges.get(), fieldChangeCount);
+  if (changes.count() == 0) {
+    return;
+  }
+
+  notifying = true;
+  for (size_t i = 0; i < observerCount; i++) {
+    if (changes.contains(observers[i].name)) {
+      observers[i].callback(observers[i].name);
+    }
+  }
+  if (changeCallback) {
+    changeCallback(changes);
+  }
+  notifying = false;
+}
+
+void ConfigManager::clearSettings(bool reboot) {
+  DebugPrintln(F("Clearing Settings...."));
+  bool observed = hasObservers();
+
+  parameters.clearChanges();
+  clearFieldChanges();
+  for (size_t i = 0; i < parameters.size(); i++) {
+    BaseParameter* param = parameters[i];
+    // Parameters outside the config struct are not stored, their cleared
+    // values are all zero bytes.
+    if (observed && configOffset(param) < 0) {
+      const uint8_t* data = (const uint8_t*)param->getData();
+      for (size_t j = 0; j < param->getSize(); j++) {
+        if (data[j] != 0) {
+          parameters.markChanged(i);
+          break;
+        }
+      }
+    }
+    param->clearData();
+  }
+  if (schemaClear && config) {
+    schemaClear(config);
+  }
+
+  // The config is compared with the stored image once cleared, a field
+  // cleared to a default it already held did not change.
+  if (observed && config) {
+    diffParameters();
+    if (schemaClear) {
+      diffFields();
+    }
+  }
+
+  writeConfig();
+  notifyChanges();
+
+  if (reboot) {
+    flush();
+    ESP.restart();
+  }
+}
+
+bool ConfigManager::setMaxParameters(size_t count) {
+  return parameters.reserve(count);
+}
+
+ParameterFootprint ConfigManager::getParameterFootprint() {
+  return parameters.footprint();
+}
+
+//
+// Parameter Registry
+//
+static uint32_t hashName(const char* name, size_t length) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static size_t alignUp(size_t value, size_t align) {
+  return (value + align - 1) & ~(align - 1);
+}
+
+bool ParameterRegistry::reserve(size_t capacity) {
+  if (memory) {
+    DebugPrintln(F("Parameters must be reserved before they are added"));
+    return false;
+  }
+  if (capacity == 0 || capacity >= 0xFFFF) {
+    return false;
+  }
+
+  // Keep the index at most half full so probe sequences stay short.
+  size_t indexSize = 1;
+  while (indexSize < capacity * 2) {
+    indexSize <<= 1;
+  }
+
+  const size_t align = alignof(double);
+  size_t paramsBytes = alignUp(capacity * sizeof(BaseParameter*), align);
+  size_t hashesBytes = alignUp(capacity * sizeof(uint32_t), align);
+  size_t changedBytes = alignUp((capacity + 7) / 8, align);
+  size_t indexBytes = alignUp(indexSize * sizeof(uint16_t), align);
+  // String parameters are the largest parameter objects.
+  size_t arenaBytes =
+      alignUp(capacity * alignUp(sizeof(ConfigStringParameter), align), align);
+
+  memorySize =
+      paramsBytes + hashesBytes + changedBytes + indexBytes + arenaBytes;
+  memory.reset(new (std::nothrow) uint8_t[memorySize]);
+  if (!memory) {
+    memorySize = 0;
+    return false;
+  }
+
+  uint8_t* ptr = memory.get();
+  params = (BaseParameter**)ptr;
+  hashes = (uint32_t*)(ptr += paramsBytes);
+  changed = ptr += hashesBytes;
+  index = (uint16_t*)(ptr += changedBytes);
+  arena = ptr += indexBytes;
+
+  memset(changed, 0, changedBytes);
+  memset(index, 0, indexSize * sizeof(uint16_t));
+  changes = 0;
+  indexMask = indexSize - 1;
+  this->capacity = capacity;
+  arenaSize = arenaBytes;
+  arenaUsed = 0;
+  count = 0;
+  return true;
+}
+
+void* ParameterRegistry::allocate(size_t size, size_t align) {
+  size_t offset = alignUp(arenaUsed, align);
+  if (offset + size > arenaSize) {
+    return NULL;
+  }
+
+  arenaUsed = offset + size;
+  return arena + offset;
+}
+
+void ParameterRegistry::insert(BaseParameter* param) {
+  const char* name = param->getName();
+  uint32_t hash = hashName(name, strlen(name));
+
+  size_t slot = hash & indexMask;
+  while (index[slot] != 0) {
+    slot = (slot + 1) & indexMask;
+  }
+
+  params[count] = param;
+  hashes[count] = hash;
+  // Slots hold the parameter position plus one, zero marks an empty slot.
+  index[slot] = ++count;
+}
+
+int ParameterRegistry::indexOf(const char* name, size_t length) {
+  if (!index) {
+    return -1;
+  }
+
+  uint32_t hash = hashName(name, length);
+  size_t slot = hash & indexMask;
+  while (index[slot] != 0) {
+    size_t i = index[slot] - 1;
+    const char* candidate = params[i]->getName();
+    if (hashes[i] == hash && strncmp(candidate, name, length) == 0 &&
+        candidate[length] == '\0') {
+      return i;
+    }
+    slot = (slot + 1) & indexMask;
+  }
+  return -1;
+}
+
+BaseParameter* ParameterRegistry::find(const char* name, size_t length) {
+  int i = indexOf(name, length);
+  return i < 0 ? NULL : params[i];
+}
+
+void ParameterRegistry::clearChanges() {
+  if (changes > 0) {
+    memset(changed, 0, (capacity + 7) / 8);
+    changes = 0;
+  }
+}
+
+void ParameterRegistry::markChanged(size_t i) {
+  if (!isChanged(i)) {
+    changed[i / 8] |= 1 << (i % 8);
+    changes++;
+  }
+}
+
+bool ParameterRegistry::isChanged(size_t i) {
+  return changed && i < count && (changed[i / 8] & (1 << (i % 8)));
+}
+
+ParameterFootprint ParameterRegistry::footprint() {
+  ParameterFootprint res;
+  res.count = count;
+  res.capacity = capacity;
+  res.arenaUsed = arenaUsed;
+  res.totalBytes = memorySize;
+  res.bytesPerParameter = count ? memorySize / count : 0;
+  return res;
+}
+
+//
+// ConfigManager HTTP Utilities
+//
+void ConfigManager::startWebserver() {
   this->server->enableCORS(true);
   this->server->begin();
   this->webserverRunning = true;
@@ -430,46 +1772,101 @@ void ConfigManager::setWebPort(const int port) {
   this->webPort = port;
 }
 
+void ConfigManager::setStorage(ConfigStorage* storage) {
+  this->storage = storage;
+}
+
 void ConfigManager::createBaseWebServer() {
-  const char* headerKeys[] = {"Content-Type"};
+  const char* headerKeys[] = {"Content-Type", "Accept", "Accept-Encoding",
+                              "If-None-Match", "If-Match"};
   size_t headerKeysSize = sizeof(headerKeys) / sizeof(char*);
 
-  server.reset(new WebServer(this->webPort));
+  if (serverFactory) {
+    server.reset(serverFactory(this->webPort));
+  } else {
+    server.reset(new SyncServer(this->webPort));
+  }
   DebugPrint(F("Webserver enabled on port: "));
   DebugPrintln(webPort);
 
   server->collectHeaders(headerKeys, headerKeysSize);
 
   server->on(this->wifiConfigURI, HTTPMethod::HTTP_GET,
-             std::bind(&ConfigManager::handleAPGet, this));
+             timed(routeConfigGet, &ConfigManager::handleAPGet));
   server->on(this->wifiConfigURI, HTTPMethod::HTTP_POST,
-             std::bind(&ConfigManager::handleAPPost, this));
+             timed(routeConfigPost, &ConfigManager::handleAPPost));
   DebugPrintln("Index page registered");
 
   server->on("/scan", HTTPMethod::HTTP_GET,
-             std::bind(&ConfigManager::handleScanGet, this));
+             timed(routeScan, &ConfigManager::handleScanGet));
   DebugPrintln("Scan page registered");
 
-  server->onNotFound(std::bind(&ConfigManager::handleNotFound, this));
+  if (metrics) {
+    server->on("/metrics", HTTPMethod::HTTP_GET,
+               std::bind(&ConfigManager::handleMetricsGet, this));
+    DebugPrintln("Metrics page registered");
+  }
+
+  server->onNotFound(timed(routeNotFound, &ConfigManager::handleNotFound));
+}
+
+void ConfigManager::setAssets(const ConfigAsset* assets, size_t count) {
+  this->assets = assets;
+  this->assetCount = count;
+}
+
+void ConfigManager::setFS(fs::FS& fs) {
+  this->fileSystem = &fs;
+}
+
+void ConfigManager::setAssetMaxAge(uint32_t seconds) {
+  this->assetMaxAge = seconds;
 }
 
 void ConfigManager::streamFile(const char* file, const char mime[]) {
-  SPIFFS.begin();
+  // Leave room for the ".gz" suffix.
+  char path[ASSET_PATH_LENGTH];
+  int length = snprintf(path, sizeof(path) - 3, "%s%s",
+                        file[0] == '/' ? "" : "/", file);
+  if (length < 0 || (size_t)length >= sizeof(path) - 3) {
+    DebugPrint(F("file path too long "));
+    DebugPrintln(file);
+    handleNotFound();
+    return;
+  }
 
-  File f;
+  if (streamAsset(path, mime)) {
+    return;
+  }
 
-  if (file[0] == '/') {
-    f = SPIFFS.open(file, "r");
-  } else {
-    size_t len = strlen(file);
-    char filepath[len + 1];
-    strcpy(filepath, "/");
-    strcat(filepath, file);
-    f = SPIFFS.open(filepath, "r");
+  // The default SPIFFS is mounted on first use, others by the sketch.
+  if (!fileSystem && !fsMounted) {
+    fsMounted = SPIFFS.begin();
+  }
+  fs::FS& fs = fileSystem ? *fileSystem : SPIFFS;
+
+  File f;
+  if (acceptsGzip()) {
+    strcpy(path + length, ".gz");
+    if (fs.exists(path)) {
+      f = fs.open(path, "r");
+    }
+    path[length] = '\0';
+  }
+  if (!f) {
+    f = fs.open(path, "r");
   }
 
   if (f) {
-    server->streamFile(f, FPSTR(mime));
+    char etag[24];
+    snprintf(etag, sizeof(etag), "W/\"%x-%lx\"", (unsigned int)f.size(),
+             (unsigned long)f.getLastWrite());
+
+    if (!notModified(etag)) {
+      sendCacheHeaders(etag);
+      // The web server sets the gzip encoding for ".gz" files itself.
+      server->streamFile(f, FPSTR(mime));
+    }
     f.close();
   } else {
     DebugPrint(F("file open failed "));
@@ -478,6 +1875,77 @@ void ConfigManager::streamFile(const char* file, const char mime[]) {
   }
 }
 
+// Serves a file from the embedded asset table, preferring the gzip variant
+// when the client accepts it. A NULL mime uses the type of the asset.
+bool ConfigManager::streamAsset(const char* path, const char* mime) {
+  bool gzip = acceptsGzip();
+  bool found = false;
+  ConfigAsset asset;
+
+  for (size_t i = 0; i < assetCount; i++) {
+    ConfigAsset entry;
+    memcpy_P(&entry, &assets[i], sizeof(entry));
+    if ((entry.gzip && !gzip) || strcmp_P(path, entry.path) != 0) {
+      continue;
+    }
+
+    asset = entry;
+    found = true;
+    if (entry.gzip == gzip) {
+      break;
+    }
+  }
+
+  if (!found) {
+    return false;
+  }
+
+  char etag[12];
+  strncpy_P(etag, asset.etag, sizeof(etag) - 1);
+  etag[sizeof(etag) - 1] = '\0';
+  if (notModified(etag)) {
+    return true;
+  }
+
+  sendCacheHeaders(etag);
+  if (asset.gzip) {
+    server->sendHeader(F("Content-Encoding"), F("gzip"));
+  }
+  server->send_P(200, mime ? mime : asset.mime, (PGM_P)asset.data,
+                 asset.length);
+  return true;
+}
+
+bool ConfigManager::acceptsGzip() {
+  return server->header("Accept-Encoding").indexOf("gzip") >= 0;
+}
+
+bool ConfigManager::notModified(const char* etag) {
+  String ifNoneMatch = server->header("If-None-Match");
+  if (ifNoneMatch.length() == 0 || ifNoneMatch.indexOf(etag) < 0) {
+    return false;
+  }
+
+  sendCacheHeaders(etag);
+  server->send(304);
+  return true;
+}
+
+void ConfigManager::sendCacheHeaders(const char* etag) {
+  char cacheControl[24];
+  if (assetMaxAge > 0) {
+    snprintf(cacheControl, sizeof(cacheControl), "max-age=%lu",
+             (unsigned long)assetMaxAge);
+  } else {
+    // Revalidate every time, an unchanged file costs a 304 without a body.
+    strcpy(cacheControl, "no-cache");
+  }
+
+  server->sendHeader(F("Cache-Control"), cacheControl);
+  server->sendHeader(F("ETag"), etag);
+  server->sendHeader(F("Vary"), F("Accept-Encoding"));
+}
+
 void ConfigManager::handleAPGet() {
   DebugPrint(F("Index Page: "));
   DebugPrintln(apFilename);
@@ -490,10 +1958,16 @@ void ConfigManager::handleAPPost() {
   String password;
 
   if (isJson) {
-    JsonObject obj = decodeJson(server->arg("plain"));
-
-    ssid = String((const char*)obj["ssid"]);
-    password = String((const char*)obj["password"]);
+    StaticJsonDocument<JSON_OBJECT_SIZE(2)> filter;
+    filter["ssid"] = true;
+    filter["password"] = true;
+
+    StaticJsonDocument<JSON_OBJECT_SIZE(2) + SSID_LENGTH + PASSWORD_LENGTH + 16>
+        doc;
+    if (decodeJson(server->arg("plain"), doc, filter)) {
+      ssid = String((const char*)doc["ssid"]);
+      password = String((const char*)doc["password"]);
+    }
   } else {
     ssid = server->arg("ssid");
     password = server->arg("password");
@@ -510,6 +1984,7 @@ void ConfigManager::handleAPPost() {
   }
 
   server->send(204, FPSTR(mimePlain), F("Saved. Will attempt to reboot."));
+  flush();
   // Allow enough time for the response to be sent before restarting.
   delay(500);
 
@@ -517,22 +1992,109 @@ void ConfigManager::handleAPPost() {
 }
 
 void ConfigManager::handleScanGet() {
-  String body = scanNetworks();
-  server->send(200, FPSTR(mimeJSON), body);
+  // Results older than the max age are refreshed in the background, the
+  // request is answered from the cache meanwhile.
+  if (!scanFresh()) {
+    startScan();
+  }
+
+  if (!scanValid) {
+    server->sendHeader(F("Retry-After"), F("1"));
+    server->send(202, FPSTR(mimeJSON), F("[]"));
+    return;
+  }
+
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server->send(200, FPSTR(mimeJSON), "");
+
+  ChunkedPrint out(server.get());
+  printScan(out);
+  out.flush();
+  server->sendContent("");
+}
+
+// Only committed settings have an ETag, a change still waiting for its
+// commit may yet be lost and its generation reused.
+bool ConfigManager::printETag(char* etag) {
+  if (dirtyCount > 0) {
+    etag[0] = '\0';
+    return false;
+  }
+  snprintf(etag, 11, "\"%08x\"", (unsigned int)generation);
+  return true;
 }
 
 void ConfigManager::handleSettingsGetREST() {
-  JsonObject obj = asJson();
-  String body;
-  serializeJson(obj, body);
+  bool isMsgPack = server->header("Accept").indexOf(FPSTR(mimeMsgPack)) >= 0;
+  char etag[11];
+  bool committed = printETag(etag);
+
+  // JSON and MessagePack share the ETag, caches must key on Accept too.
+  server->sendHeader("Vary", "Accept");
+
+  // Clients that hold the current generation skip the body entirely.
+  String ifNoneMatch = server->header("If-None-Match");
+  if (ifNoneMatch == "*" || (committed && ifNoneMatch.indexOf(etag) >= 0)) {
+    if (committed) {
+      server->sendHeader("ETag", etag);
+    }
+    server->send(304);
+    return;
+  }
+
+  if (committed) {
+    server->sendHeader("ETag", etag);
+  }
+
+  // Stream the settings one parameter at a time, memory use does not grow
+  // with the number of parameters.
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server->send(200, isMsgPack ? FPSTR(mimeMsgPack) : FPSTR(mimeJSON), "");
+
+  ChunkedPrint out(server.get());
+  size_t length = isMsgPack ? printMsgPack(out) : printJson(out);
+  out.flush();
+  server->sendContent("");
 
-  DebugPrintln(body);
-  server->send(200, FPSTR(mimeJSON), body);
+  DebugPrint(F("Settings sent: "));
+  DebugPrintln(length);
 }
 
 void ConfigManager::handleSettingsPutREST() {
-  DynamicJsonDocument doc(1024);
-  auto error = deserializeJson(doc, server->arg("plain"));
+  bool isMsgPack = server->header("Content-Type") == FPSTR(mimeMsgPack);
+  char etag[11];
+  bool committed = printETag(etag);
+
+  // Refuse to overwrite settings the client has not seen.
+  String ifMatch = server->header("If-Match");
+  if (ifMatch.length() > 0 && ifMatch != "*" &&
+      (!committed || ifMatch.indexOf(etag) < 0)) {
+    if (committed) {
+      server->sendHeader("ETag", etag);
+    }
+    server->send(412, FPSTR(mimeJSON), "");
+    return;
+  }
+
+  if (!putFilter || filterParameters != parameters.size()) {
+    buildFilter();
+  }
+
+  // The synchronous servers buffer the body before calling the handler, it
+  // is parsed from there. Unknown keys are dropped while parsing, and a
+  // body can hold no more members than a third of its length.
+  const String& body = server->arg("plain");
+  size_t length = body.length();
+  DynamicJsonDocument doc(
+      min(putCapacity, JSON_OBJECT_SIZE(length / 3 + 1) + length));
+  DeserializationOption::Filter filter(*putFilter);
+  DeserializationError error = isMsgPack
+                                   ? deserializeMsgPack(doc, body, filter)
+                                   : deserializeJson(doc, body, filter);
+  if (error == DeserializationError::NoMemory) {
+    server->send(413, FPSTR(mimeJSON), "");
+    return;
+  }
   if (error) {
     server->send(400, FPSTR(mimeJSON), "");
     return;
@@ -541,26 +2103,250 @@ void ConfigManager::handleSettingsPutREST() {
   JsonObject obj = doc.as<JsonObject>();
   updateFromJson(obj);
 
+  if (printETag(etag)) {
+    server->sendHeader("ETag", etag);
+  }
   server->send(204, FPSTR(mimeJSON), "");
 }
 
+void ConfigManager::handleRegionGet(size_t index) {
+  ConfigRegion& region = regions[index];
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server->send(200, FPSTR(mimeJSON), "");
+
+  ChunkedPrint out(server.get());
+  bool first = true;
+  out.print('{');
+  region.printJson(out, region.data, first);
+  out.print('}');
+  out.flush();
+  server->sendContent("");
+}
+
+void ConfigManager::handleRegionPut(size_t index) {
+  ConfigRegion& region = regions[index];
+  if (!regionFilters[index]) {
+    buildRegionFilter(index);
+  }
+
+  // Parsed like PUT /settings, only the region's writable fields are kept.
+  const String& body = server->arg("plain");
+  size_t length = body.length();
+  DynamicJsonDocument doc(
+      min(region.putCapacity, JSON_OBJECT_SIZE(length / 3 + 1) + length));
+  DeserializationOption::Filter filter(*regionFilters[index]);
+  DeserializationError error = deserializeJson(doc, body, filter);
+  if (error == DeserializationError::NoMemory) {
+    server->send(413, FPSTR(mimeJSON), "");
+    return;
+  }
+  if (error) {
+    server->send(400, FPSTR(mimeJSON), "");
+    return;
+  }
+
+  size_t changes = 0;
+  for (JsonPair kv : doc.as<JsonObject>()) {
+    size_t offset;
+    size_t size;
+    if (region.fromJson(region.data, kv.key().c_str(), kv.value(), &offset,
+                        &size) > 0) {
+      changes++;
+    }
+  }
+
+  if (changes > 0) {
+    writeRegion(index);
+  }
+  server->send(204, FPSTR(mimeJSON), "");
+}
+
+void ConfigManager::handleSchemaGet() {
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server->send(200, FPSTR(mimeJSON), "");
+
+  ChunkedPrint out(server.get());
+  schemaPrintSchema(out);
+  out.flush();
+  server->sendContent("");
+}
+
+// The routes are wrapped when they are registered, so metrics can only be
+// switched before the server is created.
+bool ConfigManager::setMetricsEnabled(bool enabled) {
+  if (server) {
+    return (bool)metrics == enabled;
+  }
+
+  if (enabled && !metrics) {
+    metrics.reset(new ConfigMetrics());
+  } else if (!enabled) {
+    metrics.reset();
+  }
+  return true;
+}
+
+// Wraps a handler so its latency is recorded, when metrics are enabled.
+// Without them the plain handler is registered and costs nothing.
+std::function<void()> ConfigManager::timed(MetricsRoute route,
+                                           void (ConfigManager::*handler)()) {
+  return timed(route, std::bind(handler, this));
+}
+
+std::function<void()> ConfigManager::timed(MetricsRoute route,
+                                           std::function<void()> handler) {
+  if (!metrics) {
+    return handler;
+  }
+
+  return [this, route, handler]() {
+    unsigned long start = micros();
+    handler();
+    metrics->routes[route].observe(micros() - start);
+  };
+}
+
+static size_t printMetricName(Print& out,
+                              const __FlashStringHelper* name,
+                              const __FlashStringHelper* type) {
+  size_t n = out.print(F("# TYPE "));
+  n += out.print(name);
+  n += out.print(' ');
+  n += out.print(type);
+  n += out.print('\n');
+  n += out.print(name);
+  return n + out.print(' ');
+}
+
+// Counters and byte gauges are printed as integers.
+static size_t printMetric(Print& out,
+                          const __FlashStringHelper* name,
+                          const __FlashStringHelper* type,
+                          uint32_t value) {
+  size_t n = printMetricName(out, name, type);
+  n += out.print((unsigned long)value);
+  return n + out.print('\n');
+}
+
+static size_t printMetric(Print& out,
+                          const __FlashStringHelper* name,
+                          const __FlashStringHelper* type,
+                          double value,
+                          int digits) {
+  size_t n = printMetricName(out, name, type);
+  n += out.print(value, digits);
+  return n + out.print('\n');
+}
+
+size_t ConfigManager::printMetrics(Print& out) {
+  if (!metrics) {
+    return 0;
+  }
+
+  const char* paths[routeCount] = {wifiConfigURI, wifiConfigURI, "/scan",
+                                   "/settings",   "/settings",   "/schema",
+                                   "/settings/*", "/settings/*", "notFound"};
+  const char* methods[routeCount] = {"GET", "POST", "GET", "GET", "PUT",
+                                     "GET", "GET",  "PUT", "ANY"};
+  char labels[80];
+  size_t n = 0;
+
+  n += out.print(F("# TYPE configmanager_http_request_duration_seconds "
+                   "histogram\n"));
+  for (size_t i = 0; i < routeCount; i++) {
+    snprintf(labels, sizeof(labels), "route=\"%s\",method=\"%s\"", paths[i],
+             methods[i]);
+    n += metrics->routes[i].print(
+        out, F("configmanager_http_request_duration_seconds"), labels);
+  }
+  n += printMetric(out, F("configmanager_http_redirects_total"), F("counter"),
+                   metrics->redirects);
+
+  if (portalDns) {
+    DNSStats dns = portalDns->getStats();
+    n += printMetric(out, F("configmanager_dns_answered_total"), F("counter"),
+                     dns.answered);
+    n += printMetric(out, F("configmanager_dns_dropped_total"), F("counter"),
+                     dns.dropped);
+    n += printMetric(out, F("configmanager_dns_queue_seconds_max"),
+                     F("gauge"), dns.maxQueueMicros / 1e6, 6);
+  }
+
+  n += printMetric(out, F("configmanager_storage_commits_total"), F("counter"),
+                   commitStats.performed);
+  n += printMetric(out, F("configmanager_storage_commits_skipped_total"),
+                   F("counter"), commitStats.skipped);
+  n += out.print(F("# TYPE configmanager_storage_commit_duration_seconds "
+                   "histogram\n"));
+  n += metrics->commits.print(
+      out, F("configmanager_storage_commit_duration_seconds"), "");
+  n += printMetric(out, F("configmanager_storage_generation"), F("gauge"),
+                   generation);
+
+  n += printMetric(out, F("configmanager_wifi_connect_attempts_total"),
+                   F("counter"), metrics->wifiAttempts);
+  n += printMetric(out, F("configmanager_wifi_reconnects_total"),
+                   F("counter"), metrics->wifiReconnects);
+  n += printMetric(out, F("configmanager_wifi_connect_time_seconds"),
+                   F("gauge"), wifiConnectTime / 1000.0, 3);
+  n += printMetric(out, F("configmanager_wifi_connected"), F("gauge"),
+                   (uint32_t)(wifiConnected() ? 1 : 0));
+
+  uint32_t freeHeap = ESP.getFreeHeap();
+#if defined(ARDUINO_ARCH_ESP8266)
+  uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+  double fragmentation = ESP.getHeapFragmentation() / 100.0;
+#else
+  uint32_t maxBlock = ESP.getMaxAllocHeap();
+  double fragmentation = freeHeap ? 1.0 - (double)maxBlock / freeHeap : 0;
+#endif
+  n += printMetric(out, F("configmanager_heap_free_bytes"), F("gauge"),
+                   freeHeap);
+  n += printMetric(out, F("configmanager_heap_max_block_bytes"), F("gauge"),
+                   maxBlock);
+  n += printMetric(out, F("configmanager_heap_fragmentation_ratio"),
+                   F("gauge"), fragmentation, 3);
+  return n;
+}
+
+void ConfigManager::handleMetricsGet() {
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server->send(200, F("text/plain; version=0.0.4"), "");
+
+  ChunkedPrint out(server.get());
+  printMetrics(out);
+  out.flush();
+  server->sendContent("");
+}
+
 void ConfigManager::handleNotFound() {
   if (server->method() == HTTP_OPTIONS) {
     server->send(200);
   }
 
-  String URI =
-      toStringIP(server->client().localIP()) + String(":") + String(webPort);
-  String header = server->hostHeader();
+  // The portal host is the address of the current mode's interface.
+  if (portalRedirectLength == 0 || portalMode != this->getMode()) {
+    preparePortal(server->localIP());
+  }
+
+  // Connectivity checks are answered before anything else, without
+  // looking at the host.
+  const char* uri = server->uriCStr();
+  if (this->getMode() == ap && isProbe(uri)) {
+    sendPortalRedirect();
+    return;
+  }
 
-  if (!isIp(header) && header != URI) {
+  const char* host = server->hostHeaderCStr();
+  if (!isIp(host) && strcmp(host, portalHost) != 0) {
     DebugPrint(F("Unknown URL: "));
-    DebugPrintln(header);
-    server->sendHeader("Location", String("http://") + URI, true);
-    server->send(302, FPSTR(mimePlain), "");
-    // Empty content inhibits Content-length header so we
-    // have to close the socket ourselves.
-    server->client().stop();
+    DebugPrintln(host);
+    sendPortalRedirect();
+    return;
+  }
+
+  // Embedded assets are served without registering a route for each.
+  if (server->method() == HTTP_GET && streamAsset(uri, NULL)) {
     return;
   }
 
@@ -568,25 +2354,75 @@ void ConfigManager::handleNotFound() {
 }
 
 //
-// ConfigManager General Util
+// ConfigManager Captive Portal
 //
-boolean ConfigManager::isIp(String str) {
-  for (uint i = 0; i < str.length(); i++) {
-    int c = str.charAt(i);
-    if (c != '.' && (c < '0' || c > '9')) {
-      return false;
+
+// Connectivity checks of common clients. Anything but the expected answer
+// makes them open the portal.
+static const char probeAndroid[] PROGMEM = "/generate_204";
+static const char probeAndroidShort[] PROGMEM = "/gen_204";
+static const char probeApple[] PROGMEM = "/hotspot-detect.html";
+static const char probeAppleLibrary[] PROGMEM = "/library/test/success.html";
+static const char probeWindows[] PROGMEM = "/ncsi.txt";
+static const char probeWindowsTest[] PROGMEM = "/connecttest.txt";
+static const char probeWindowsRedirect[] PROGMEM = "/redirect";
+static const char probeFirefox[] PROGMEM = "/canonical.html";
+static const char probeFirefoxSuccess[] PROGMEM = "/success.txt";
+static const char probeKindle[] PROGMEM = "/kindle-wifi/wifistub.html";
+
+static const char* const portalProbes[] PROGMEM = {
+    probeAndroid,         probeAndroidShort, probeApple,
+    probeAppleLibrary,    probeWindows,      probeWindowsTest,
+    probeWindowsRedirect, probeFirefox,      probeFirefoxSuccess,
+    probeKindle,
+};
+
+// Prepares the portal host and the redirect response, so answering a
+// probe allocates nothing.
+void ConfigManager::preparePortal(IPAddress ip) {
+  portalMode = this->getMode();
+  snprintf_P(portalHost, sizeof(portalHost), PSTR("%u.%u.%u.%u:%u"), ip[0],
+             ip[1], ip[2], ip[3], (unsigned)webPort);
+
+  int n = snprintf_P(portalRedirect, sizeof(portalRedirect),
+                     PSTR("HTTP/1.1 302 Found\r\n"
+                          "Location: http://%s\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n\r\n"),
+                     portalHost);
+  portalRedirectLength = n > 0 && (size_t)n < sizeof(portalRedirect) ? n : 0;
+}
+
+bool ConfigManager::isProbe(const char* uri) {
+  for (size_t i = 0; i < sizeof(portalProbes) / sizeof(portalProbes[0]);
+       i++) {
+    if (strcmp_P(uri, (const char*)pgm_read_ptr(&portalProbes[i])) == 0) {
+      return true;
     }
   }
-  return true;
+  return false;
 }
 
-String ConfigManager::toStringIP(IPAddress ip) {
-  String res = "";
-  for (int i = 0; i < 3; i++) {
-    res += String((ip >> (8 * i)) & 0xFF) + ".";
+// The response goes straight to the client, the server would build its
+// headers in Strings.
+void ConfigManager::sendPortalRedirect() {
+  if (metrics) {
+    metrics->redirects++;
   }
-  res += String(((ip >> 8 * 3)) & 0xFF);
-  return res;
+
+  server->sendRaw(portalRedirect, portalRedirectLength);
+}
+
+//
+// ConfigManager General Util
+//
+boolean ConfigManager::isIp(const char* str) {
+  for (; *str; str++) {
+    if (*str != '.' && (*str < '0' || *str > '9')) {
+      return false;
+    }
+  }
+  return true;
 }
 
 #ifdef localbuild
@@ -5,23 +5,24 @@
 #include <EEPROM.h>
 #include <FS.h>
 
-#if defined(ARDUINO_ARCH_ESP8266)  // ESP8266
-#include <ESP8266WebServer.h>
-#include <ESP8266WiFi.h>
-#elif defined(ARDUINO_ARCH_ESP32)  // ESP32
+#if defined(ARDUINO_ARCH_ESP32)  // ESP32
 #include <SPIFFS.h>
-#include <WebServer.h>
-#include <WiFi.h>
 #endif
 
 #include <functional>
-#include <list>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 #include "ArduinoJson.h"
+#include "ConfigDNS.h"
+#include "ConfigMetrics.h"
+#include "ConfigScheduler.h"
+#include "ConfigServer.h"
+#include "ConfigStorage.h"
 
 #if defined(ARDUINO_ARCH_ESP8266)  // ESP8266
 #define WIFI_OPEN ENC_TYPE_NONE
-using WebServer = ESP8266WebServer;
 #elif defined(ARDUINO_ARCH_ESP32)  // ESP32
 #define WIFI_OPEN WIFI_AUTH_OPEN
 #endif
@@ -32,6 +33,35 @@ using WebServer = ESP8266WebServer;
 // where configs start in memory
 // MAGIC_LENGTH + SSID_LENGTH + PASSWORD_LENGTH
 #define CONFIG_OFFSET 98
+// Stored right after the config, so existing layouts stay readable.
+#define GENERATION_LENGTH 4
+
+// Longest wait between reconnect attempts, in milliseconds.
+#ifndef WIFI_BACKOFF_MAX
+#define WIFI_BACKOFF_MAX 60000
+#endif
+
+// "255.255.255.255:65535" and the redirect sent to captive portal clients.
+#define PORTAL_HOST_LENGTH 22
+#define PORTAL_REDIRECT_LENGTH 128
+
+// Longest path, including the ".gz" suffix, streamFile looks up.
+#define ASSET_PATH_LENGTH 64
+
+// Parameters reserved when addParameter is called without setMaxParameters.
+#ifndef CONFIG_MAX_PARAMETERS
+#define CONFIG_MAX_PARAMETERS 32
+#endif
+
+// Regions persisted next to the config, see addRegion.
+#ifndef CONFIG_MAX_REGIONS
+#define CONFIG_MAX_REGIONS 4
+#endif
+
+// Per parameter change observers, see addChangeObserver.
+#ifndef CONFIG_MAX_OBSERVERS
+#define CONFIG_MAX_OBSERVERS 8
+#endif
 
 extern bool DEBUG_MODE;
 
@@ -40,22 +70,120 @@ extern bool DEBUG_MODE;
 
 extern const char mimeHTML[];
 extern const char mimeJSON[];
+extern const char mimeMsgPack[];
 extern const char mimePlain[];
 extern const char mimeCSS[];
 extern const char mimeJS[];
 
 enum wifiModes { ap, station };
+enum WifiState {
+  wifiIdle,
+  wifiConnecting,
+  wifiBackoff,
+  wifiOnline,
+  wifiAccessPoint
+};
 enum ParameterMode { get, set, both };
 
+/**
+ * Commit Stats
+ */
+struct CommitStats {
+  uint32_t performed;     // commits that wrote to flash
+  uint32_t skipped;       // commits skipped as nothing changed
+  uint32_t bytesChanged;  // bytes that differed from the persisted image
+};
+
+/**
+ * Wifi Cache
+ *
+ * The network of the last successful connection, stored after the
+ * generation so a reconnect can skip the scan and DHCP.
+ */
+struct WifiCache {
+  uint32_t key;  // hash of the SSID it was stored for
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t mask;
+  uint32_t dns;
+};
+
+/**
+ * Scan Result
+ */
+struct ScanResult {
+  char ssid[SSID_LENGTH + 1];
+  int8_t rssi;
+  bool secure;
+};
+
+/**
+ * Config Region
+ *
+ * A struct persisted on its own after the config, with its own dirty flag
+ * and save interval. Each region is stored behind a key made from its name
+ * and size, a region that does not match keeps its initial values.
+ */
+struct ConfigRegion {
+  const char* name;
+  void* data;
+  size_t size;
+  size_t offset;           // of the data in the storage image
+  unsigned long interval;  // milliseconds between saves of a dirty region
+  unsigned long lastSave;
+  bool dirty;
+
+  // Set for regions described by a ConfigSchema, served on the REST API.
+  size_t (*printJson)(Print&, const void*, bool&);
+  int (*fromJson)(void*, const char*, JsonVariant, size_t*, size_t*);
+  size_t (*filter)(JsonObject*, size_t*);
+  size_t putCapacity;  // of the document PUT bodies are parsed into
+};
+
+/**
+ * Config Asset
+ *
+ * A file embedded in flash, generated from a data directory by
+ * tools/assets.py. All pointers point to PROGMEM.
+ */
+struct ConfigAsset {
+  const char* path;
+  const char* mime;
+  const char* etag;
+  const uint8_t* data;
+  uint32_t length;
+  bool gzip;
+};
+
+// Whether a JSON value can be applied to a T. Booleans also take integers,
+// PUT /settings accepted 0 and 1 for them before values were type checked.
+template <typename T>
+inline bool acceptsJson(JsonVariant value) {
+  return value.is<T>() || (std::is_same<T, bool>::value && value.is<int>());
+}
+
 /**
  * Base Parameter
  */
 class BaseParameter {
  public:
+  const char* getName() { return name; }
+
   virtual ParameterMode getMode() = 0;
-  virtual void fromJson(JsonObject* json) = 0;
+  virtual void* getData() = 0;
+  virtual size_t getSize() = 0;
+  // Applies the value, returning true if it changed the parameter.
+  virtual bool fromJson(JsonVariant value) = 0;
   virtual void toJson(JsonObject* json) = 0;
+  virtual size_t printJson(Print& out) = 0;
+  virtual size_t printMsgPack(Print& out) = 0;
   virtual void clearData() = 0;
+
+ protected:
+  const char* name;
 };
 
 /**
@@ -71,18 +199,39 @@ class ConfigParameter : public BaseParameter {
   }
 
   ParameterMode getMode() { return this->mode; }
+  void* getData() { return ptr; }
+  size_t getSize() { return sizeof(T); }
 
   void update(T value) { *ptr = value; }
 
-  void fromJson(JsonObject* json) {
-    const T value = (*json)[name];
-    if (value) {
-      this->update(value);
+  bool fromJson(JsonVariant value) {
+    if (!acceptsJson<T>(value)) {
+      return false;
     }
+
+    const T newValue = value.as<T>();
+    if (newValue == *ptr) {
+      return false;
+    }
+
+    this->update(newValue);
+    return true;
   }
 
   void toJson(JsonObject* json) { (*json)[name] = *ptr; }
 
+  size_t printJson(Print& out) {
+    StaticJsonDocument<16> doc;
+    doc.set(*ptr);
+    return serializeJson(doc, out);
+  }
+
+  size_t printMsgPack(Print& out) {
+    StaticJsonDocument<16> doc;
+    doc.set(*ptr);
+    return serializeMsgPack(doc, out);
+  }
+
   void clearData() {
     DebugPrint("Clearing: ");
     DebugPrintln(name);
@@ -90,9 +239,7 @@ class ConfigParameter : public BaseParameter {
   }
 
  private:
-  const char* name;
   T* ptr;
-  std::function<void(const char*)> cb;
   ParameterMode mode;
 };
 
@@ -112,21 +259,41 @@ class ConfigStringParameter : public BaseParameter {
   }
 
   ParameterMode getMode() { return this->mode; }
+  void* getData() { return ptr; }
+  size_t getSize() { return length; }
 
   void update(const char* value) {
     memset(ptr, 0, length);
     strncpy(ptr, value, length - 1);
   }
 
-  void fromJson(JsonObject* json) {
-    const char* value = (*json)[name];
-    if (value) {
-      this->update(value);
+  // Strings that do not fit are rejected rather than cut.
+  bool fromJson(JsonVariant value) {
+    const char* newValue = value.as<const char*>();
+    if (!newValue || strlen(newValue) >= length ||
+        strncmp(ptr, newValue, length) == 0) {
+      return false;
     }
+
+    this->update(newValue);
+    return true;
   }
 
   void toJson(JsonObject* json) { (*json)[name] = (const char*)ptr; }
 
+  size_t printJson(Print& out) {
+    // The document only references the string, it is not copied.
+    StaticJsonDocument<16> doc;
+    doc.set((const char*)ptr);
+    return serializeJson(doc, out);
+  }
+
+  size_t printMsgPack(Print& out) {
+    StaticJsonDocument<16> doc;
+    doc.set((const char*)ptr);
+    return serializeMsgPack(doc, out);
+  }
+
   void clearData() {
     DebugPrint("Clearing: ");
     DebugPrintln(name);
@@ -134,12 +301,118 @@ class ConfigStringParameter : public BaseParameter {
   }
 
  private:
-  const char* name;
   char* ptr;
   size_t length;
   ParameterMode mode;
 };
 
+/**
+ * Parameter Footprint
+ */
+struct ParameterFootprint {
+  size_t count;              // registered parameters
+  size_t capacity;           // parameters the registry was sized for
+  size_t arenaUsed;          // bytes used by parameter objects
+  size_t totalBytes;         // bytes allocated by the registry
+  size_t bytesPerParameter;  // total bytes per registered parameter
+};
+
+/**
+ * Parameter Registry
+ *
+ * Parameters are constructed in place in one fixed capacity allocation,
+ * holding the parameter objects, a contiguous list of them and an open
+ * addressed name hash index.
+ */
+class ParameterRegistry {
+ public:
+  bool reserve(size_t capacity);
+
+  template <typename P, typename... Args>
+  bool add(Args&&... args) {
+    if (!memory && !reserve(CONFIG_MAX_PARAMETERS)) {
+      return false;
+    }
+    if (count == capacity) {
+      DebugPrintln(F("Parameter capacity reached, see setMaxParameters"));
+      return false;
+    }
+
+    void* mem = allocate(sizeof(P), alignof(P));
+    if (!mem) {
+      return false;
+    }
+    insert(new (mem) P(std::forward<Args>(args)...));
+    return true;
+  }
+
+  int indexOf(const char* name, size_t length);
+  BaseParameter* find(const char* name, size_t length);
+  BaseParameter* operator[](size_t i) { return params[i]; }
+  size_t size() { return count; }
+  ParameterFootprint footprint();
+
+  void clearChanges();
+  void markChanged(size_t i);
+  bool isChanged(size_t i);
+  size_t changeCount() { return changes; }
+
+ private:
+  std::unique_ptr<uint8_t[]> memory;
+  size_t memorySize = 0;
+
+  BaseParameter** params = NULL;
+  uint32_t* hashes = NULL;
+  uint8_t* changed = NULL;
+  size_t changes = 0;
+  uint16_t* index = NULL;
+  size_t indexMask = 0;
+  size_t capacity = 0;
+  size_t count = 0;
+
+  uint8_t* arena = NULL;
+  size_t arenaSize = 0;
+  size_t arenaUsed = 0;
+
+  void* allocate(size_t size, size_t align);
+  void insert(BaseParameter* param);
+};
+
+/**
+ * Parameter Changes
+ *
+ * The parameters and schema fields changed by the last update, valid until
+ * the next one.
+ */
+class ParameterChanges {
+ public:
+  ParameterChanges(ParameterRegistry* registry,
+                   const char* const* fields = NULL,
+                   size_t fieldCount = 0)
+      : registry(registry), fields(fields), fieldCount(fieldCount) {}
+
+  // Includes changed schema fields.
+  size_t count() { return registry->changeCount() + fieldCount; }
+  bool contains(size_t index) { return registry->isChanged(index); }
+  bool contains(const char* name) {
+    int i = registry->indexOf(name, strlen(name));
+    if (i >= 0) {
+      return registry->isChanged(i);
+    }
+    for (size_t j = 0; j < fieldCount; j++) {
+      if (strcmp_P(name, fields[j]) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  ParameterRegistry* registry;
+  const char* const* fields;  // names in flash
+  size_t fieldCount;
+};
+
 /**
  * Config Manager
  */
@@ -148,8 +421,12 @@ class ConfigManager {
   ConfigManager() {}
 
   JsonObject asJson();
+  size_t printJson(Print& out);
+  size_t printMsgPack(Print& out);
   wifiModes getMode();
+  WifiState getWifiState();
   String scanNetworks();
+  size_t printScan(Print& out);
 
   void setAPName(const char* name);
   void setAPPassword(const char* password);
@@ -158,58 +435,187 @@ class ConfigManager {
   void setWifiConfigURI(const char* uri);
   void setWifiConnectRetries(const int retries);
   void setWifiConnectInterval(const int interval);
+  void setWifiConnectAsync(bool async);
+  void setWifiFastConnect(bool enabled, bool staticIP = false);
+  unsigned long getWifiConnectTime();
+  void setScanMaxAge(int seconds);
   void setWebPort(const int port);
+  void setStorage(ConfigStorage* storage);
+  void setAssets(const ConfigAsset* assets, size_t count);
+  void setAssetMaxAge(uint32_t seconds);
+  void setFS(fs::FS& fs);
+  void setLoopBudget(unsigned long micros);
+  void setDNSBatch(size_t maxPackets, unsigned long budgetMicros = 0);
+  DNSStats getDNSStats();
+  bool addTask(const char* name,
+               uint8_t priority,
+               unsigned long interval,
+               std::function<void()> fn);
+  bool setTaskPriority(const char* name, uint8_t priority);
+  size_t getTaskCount();
+  TaskStats getTaskStats(size_t index);
+  void resetTaskStats();
+  bool setMetricsEnabled(bool enabled);
+  size_t printMetrics(Print& out);
   void loop();
   void streamFile(const char* file, const char mime[]);
   void handleNotFound();
   void clearSettings(bool reboot);
   void clearWifiSettings(bool reboot);
   void clearAllSettings(bool reboot);
-  void updateFromJson(JsonObject obj);
+  ParameterChanges updateFromJson(JsonObject obj);
   void setAPCallback(std::function<void(WebServer*)> callback);
+  void setAPCallback(std::function<void(ConfigServer*)> callback);
   void setAPICallback(std::function<void(WebServer*)> callback);
+  void setAPICallback(std::function<void(ConfigServer*)> callback);
+  void setServer(std::function<ConfigServer*(int port)> factory);
   void setInitCallback(std::function<void()> callback);
+  void setWifiStateCallback(std::function<void(WifiState)> callback);
+  void setChangeCallback(std::function<void(ParameterChanges)> callback);
+  bool addChangeObserver(const char* name,
+                         std::function<void(const char*)> callback);
   void startWebserver();
   void stopWebserver();
   void save();
+  void setCommitDelay(unsigned long quietMillis, unsigned long maxMillis);
+  void setCommitInterval(unsigned long interval);
+  bool flush();
+  bool commitPending();
   bool wifiConnected();
+  CommitStats getCommitStats();
+  uint32_t getGeneration();
+  bool setMaxParameters(size_t count);
+  ParameterFootprint getParameterFootprint();
 
   template <typename T>
   void begin(T& config) {
     this->config = &config;
     this->configSize = sizeof(T);
 
-    EEPROM.begin(CONFIG_OFFSET + this->configSize);
-    this->memoryInitialized = true;
+    this->memoryInitialized = this->initStorage();
 
     setup();
   }
 
+  /**
+   * Starts without a RAM copy of the config, returning the struct inside the
+   * storage image, or NULL when the storage keeps no image in RAM. The image
+   * is only 2 byte aligned, so the struct must be packed.
+   */
+  template <typename T>
+  T* beginMapped() {
+    static_assert(alignof(T) == 1, "Mapped config structs must be packed");
+    this->configSize = sizeof(T);
+
+    if (!mapConfig()) {
+      return NULL;
+    }
+
+    setup();
+    return (T*)config;
+  }
+
+  /**
+   * Starts with a compile time ConfigSchema describing the config struct,
+   * see ConfigSchema.h.
+   */
+  template <typename Schema, typename T>
+  void begin(T& config) {
+    static_assert(std::is_same<typename Schema::Type, T>::value,
+                  "Schema does not describe the config struct");
+
+    this->schemaPrintJson = &Schema::printJson;
+    this->schemaPrintMsgPack = &Schema::printMsgPack;
+    this->schemaReadable = &Schema::readable;
+    this->schemaFromJson = &Schema::fromJson;
+    this->schemaClear = &Schema::clear;
+    this->schemaField = &Schema::field;
+    this->schemaFilter = &Schema::filter;
+    this->schemaPrintSchema = &Schema::printSchema;
+
+    begin(config);
+  }
+
+  template <typename T>
+  bool addRegion(const char* name, T& data, unsigned long interval = 0) {
+    return addRegionData(name, &data, sizeof(T), interval, NULL, NULL, NULL);
+  }
+
+  /**
+   * Adds a region described by a ConfigSchema, also served on
+   * /settings/<name>.
+   */
+  template <typename Schema, typename T>
+  bool addRegion(const char* name, T& data, unsigned long interval = 0) {
+    static_assert(std::is_same<typename Schema::Type, T>::value,
+                  "Schema does not describe the region struct");
+    return addRegionData(name, &data, sizeof(T), interval, &Schema::printJson,
+                         &Schema::fromJson, &Schema::filter);
+  }
+
+  bool saveRegion(const char* name);
+  bool markRegionDirty(const char* name);
+
   template <typename T>
   void addParameter(const char* name, T* variable) {
-    parameters.push_back(new ConfigParameter<T>(name, variable));
+    parameters.add<ConfigParameter<T> >(name, variable);
   }
   template <typename T>
   void addParameter(const char* name, T* variable, ParameterMode mode) {
-    parameters.push_back(new ConfigParameter<T>(name, variable, mode));
+    parameters.add<ConfigParameter<T> >(name, variable, mode);
   }
   void addParameter(const char* name, char* variable, size_t size) {
-    parameters.push_back(new ConfigStringParameter(name, variable, size));
+    parameters.add<ConfigStringParameter>(name, variable, size);
   }
   void addParameter(const char* name,
                     char* variable,
                     size_t size,
                     ParameterMode mode) {
-    parameters.push_back(new ConfigStringParameter(name, variable, size, mode));
+    parameters.add<ConfigStringParameter>(name, variable, size, mode);
   }
 
  private:
   wifiModes wifiMode;
-  void* config;
+  void* config = NULL;
+  // The storage image the config lives in, see beginMapped.
+  uint8_t* mappedImage = NULL;
   size_t configSize;
 
   bool memoryInitialized = false;
+
+  EEPROMStorage eepromStorage;
+  ConfigStorage* storage = &eepromStorage;
+
+  // Copy of the last committed image, used to skip unchanged writes.
+  std::unique_ptr<uint8_t[]> shadow;
+  size_t shadowSize = 0;
+  StorageRange dirty[STORAGE_MAX_RANGES];
+  size_t dirtyCount = 0;
+  CommitStats commitStats = {0, 0, 0};
+  uint32_t generation = 0;
+  bool generationPending = false;
+  // Write-behind commits, off while commitMaxDelay is 0.
+  unsigned long commitQuiet = 0;
+  unsigned long commitMaxDelay = 0;
+  unsigned long commitInterval = 0;
+  unsigned long commitFirstDirty = 0;
+  unsigned long commitLastDirty = 0;
+  unsigned long commitLast = 0;
+  bool commitQueued = false;
   bool webserverRunning = false;
+  // The host the portal is reached on and the complete redirect response
+  // to it, prepared when the address is known.
+  char portalHost[PORTAL_HOST_LENGTH] = "";
+  wifiModes portalMode = ap;  // the mode the portal host was prepared in
+  char portalRedirect[PORTAL_REDIRECT_LENGTH];
+  size_t portalRedirectLength = 0;
+  bool fsMounted = false;
+  // Where streamFile looks for files, SPIFFS when not set.
+  fs::FS* fileSystem = NULL;
+
+  const ConfigAsset* assets = NULL;
+  size_t assetCount = 0;
+  uint32_t assetMaxAge = 0;
 
   char* apName = (char*)"ConfigManager-Thing";
   char* apPassword = NULL;
@@ -222,39 +628,174 @@ class ConfigManager {
   int wifiConnectAttempts = 3;
   int wifiConnectRetries = 20;
   int wifiConnectInterval = 500;
+  bool wifiConnectAsync = false;
+  bool wifiFastConnect = false;
+  bool wifiStaticIP = false;
+  bool wifiStaticApplied = false;
+  unsigned long wifiConnectStart = 0;
+  unsigned long wifiConnectTime = 0;
+
+  WifiState wifiState = wifiIdle;
+  unsigned long wifiStateStart = 0;
+  int wifiAttempt = 0;
+  bool apiStarted = false;
 
   int webPort = 80;
 
-  std::unique_ptr<DNSServer> dnsServer;
-  std::list<BaseParameter*> parameters;
+  // Deduplicated results of the last scan, strongest first. The buffer is
+  // sized by the largest scan so far and reused.
+  std::unique_ptr<ScanResult[]> scanResults;
+  size_t scanCapacity = 0;
+  size_t scanCount = 0;
+  unsigned long scanFinished = 0;
+  int scanMaxAge = 30;
+  bool scanValid = false;
+  bool scanRunning = false;
 
-  std::unique_ptr<WebServer> server;
+  std::unique_ptr<DNSServer> dnsServer;
+  // Batched responder, used instead of dnsServer while dnsBatch is set.
+  std::unique_ptr<PortalDNS> portalDns;
+  size_t dnsBatch = 0;
+  unsigned long dnsBudget = 0;
+  ParameterRegistry parameters;
+  TaskScheduler scheduler;
+  bool tasksAdded = false;
+  std::unique_ptr<ConfigMetrics> metrics;
+
+  // Compile time schema routines, set by begin<Schema>().
+  size_t (*schemaPrintJson)(Print&, const void*, bool&) = NULL;
+  size_t (*schemaPrintMsgPack)(Print&, const void*) = NULL;
+  size_t (*schemaReadable)() = NULL;
+  int (*schemaFromJson)(void*, const char*, JsonVariant, size_t*, size_t*) =
+      NULL;
+  void (*schemaClear)(void*) = NULL;
+  bool (*schemaField)(const void*, size_t, const char**, size_t*, size_t*) =
+      NULL;
+  size_t (*schemaFilter)(JsonObject*, size_t*) = NULL;
+  size_t (*schemaPrintSchema)(Print&) = NULL;
+
+  std::unique_ptr<ConfigServer> server;
+  // Creates the server, a SyncServer when not set.
+  std::function<ConfigServer*(int port)> serverFactory;
   std::function<void(WebServer*)> apCallback;
+  std::function<void(ConfigServer*)> apServerCallback;
   std::function<void(WebServer*)> apiCallback;
+  std::function<void(ConfigServer*)> apiServerCallback;
 
   std::function<void()> initCallback;
-
-  JsonObject decodeJson(String jsonString);
+  std::function<void(WifiState)> wifiStateCallback;
+  std::function<void(ParameterChanges)> changeCallback;
+
+  struct ChangeObserver {
+    const char* name;
+    std::function<void(const char*)> callback;
+  };
+  ChangeObserver observers[CONFIG_MAX_OBSERVERS];
+  ConfigRegion regions[CONFIG_MAX_REGIONS];
+  size_t regionCount = 0;
+  size_t observerCount = 0;
+  bool notifying = false;
+  // Schema fields changed by the last update that no parameter covers.
+  std::unique_ptr<const char*[]> fieldChanges;
+  size_t fieldChangeCount = 0;
+  size_t fieldCount = 0;
+
+  // Keys a PUT /settings body is parsed for, built from the registry.
+  std::unique_ptr<DynamicJsonDocument> putFilter;
+  size_t putCapacity = 0;
+  size_t filterParameters = 0;
+  // The same per region with a schema, built on its first PUT.
+  std::unique_ptr<DynamicJsonDocument> regionFilters[CONFIG_MAX_REGIONS];
+
+  bool decodeJson(const String& jsonString,
+                  JsonDocument& doc,
+                  JsonDocument& filter);
+  void buildFilter();
+  void buildRegionFilter(size_t index);
 
   void handleAPGet();
   void handleAPPost();
   void handleScanGet();
   void handleSettingsGetREST();
   void handleSettingsPutREST();
-
-  bool wifiConnect(char* ssid, char* password);
+  void handleSchemaGet();
+  void handleMetricsGet();
+  void handleRegionGet(size_t index);
+  void handleRegionPut(size_t index);
+  std::function<void()> timed(MetricsRoute route,
+                              void (ConfigManager::*handler)());
+  std::function<void()> timed(MetricsRoute route,
+                              std::function<void()> handler);
+  bool printETag(char* etag);
+  bool acceptsGzip();
+  bool notModified(const char* etag);
+  void sendCacheHeaders(const char* etag);
+  bool streamAsset(const char* path, const char* mime);
+
+  bool wifiConnect(char* ssid, char* password, int attempt);
+  void wifiStart(const char* ssid, const char* password, int attempt);
+  void wifiOnConnected();
+  size_t wifiCacheOffset();
+  bool readWifiCache(const char* ssid, WifiCache* cache);
+  void wifiBegin();
+  bool scanFresh();
+  void startScan();
+  void scanLoop();
+  void collectScan(int count);
+  void wifiLoop();
+  unsigned long wifiBackoffDelay();
+  void setWifiState(WifiState state);
   void setup();
+  void addTasks();
   void startAP();
   void startAPApi();
   void startApi();
   void createBaseWebServer();
+  void runServerCallbacks(std::function<void(WebServer*)>& callback,
+                          std::function<void(ConfigServer*)>& serverCallback);
 
   void readConfig();
   void writeConfig();
+  bool initStorage();
+  bool mapConfig();
+  bool addRegionData(const char* name,
+                     void* data,
+                     size_t size,
+                     unsigned long interval,
+                     size_t (*printJson)(Print&, const void*, bool&),
+                     int (*fromJson)(void*,
+                                     const char*,
+                                     JsonVariant,
+                                     size_t*,
+                                     size_t*),
+                     size_t (*filter)(JsonObject*, size_t*));
+  int regionIndex(const char* name);
+  uint32_t regionKey(size_t index);
+  void loadRegions();
+  bool writeRegion(size_t index);
+  void regionLoop();
+  void writeImage(size_t offset, const void* data, size_t length);
+  void markDirty(size_t address);
+  void mergeDirty();
+  bool commitImage();
+  void readGeneration();
+  bool requestCommit();
+  void flushLoop();
+  void writeParameter(BaseParameter* param);
+  int configOffset(BaseParameter* param);
+  bool imageDiffers(size_t offset, const void* data, size_t length);
+  bool hasObservers();
+  void clearFieldChanges();
+  void markFieldChanged(size_t offset);
+  void diffParameters();
+  void diffFields();
+  void notifyChanges();
   bool commitChanges();
   void storeWifiSettings(String ssid, String password);
-  boolean isIp(String str);
-  String toStringIP(IPAddress ip);
+  void preparePortal(IPAddress ip);
+  bool isProbe(const char* uri);
+  void sendPortalRedirect();
+  boolean isIp(const char* str);
 };
 
 #endif /* __CONFIGMANAGER_H__ */
@@ -0,0 +1,61 @@
+#include "ConfigMetrics.h"
+
+static const uint32_t bucketLimits[METRICS_BUCKETS - 1] = {
+    1000, 5000, 10000, 50000, 100000, 500000, 1000000};
+static const char* const bucketLabels[METRICS_BUCKETS] = {
+    "0.001", "0.005", "0.01", "0.05", "0.1", "0.5", "1", "+Inf"};
+
+void LatencyHistogram::observe(uint32_t micros) {
+  size_t b = 0;
+  while (b < METRICS_BUCKETS - 1 && micros > bucketLimits[b]) {
+    b++;
+  }
+  buckets[b]++;
+  count++;
+  sumMicros += micros;
+}
+
+// Prints `name_suffix{labels}` and the value separator.
+static size_t printSeries(Print& out,
+                          const __FlashStringHelper* name,
+                          const __FlashStringHelper* suffix,
+                          const char* labels,
+                          const char* bucket) {
+  size_t n = out.print(name);
+  n += out.print(suffix);
+  if (labels[0] || bucket) {
+    n += out.print('{');
+    n += out.print(labels);
+    if (bucket) {
+      n += out.print(labels[0] ? F(",le=\"") : F("le=\""));
+      n += out.print(bucket);
+      n += out.print('"');
+    }
+    n += out.print('}');
+  }
+  return n + out.print(' ');
+}
+
+// Prints the histogram in the Prometheus text format. Labels, when given,
+// are written before the bucket label, e.g. `route="/scan"`.
+size_t LatencyHistogram::print(Print& out,
+                               const __FlashStringHelper* name,
+                               const char* labels) {
+  size_t n = 0;
+  uint32_t cumulative = 0;
+
+  for (size_t b = 0; b < METRICS_BUCKETS; b++) {
+    cumulative += buckets[b];
+    n += printSeries(out, name, F("_bucket"), labels, bucketLabels[b]);
+    n += out.print((unsigned long)cumulative);
+    n += out.print('\n');
+  }
+
+  n += printSeries(out, name, F("_sum"), labels, NULL);
+  n += out.print((double)sumMicros / 1000000.0, 6);
+  n += out.print('\n');
+
+  n += printSeries(out, name, F("_count"), labels, NULL);
+  n += out.print((unsigned long)count);
+  return n + out.print('\n');
+}
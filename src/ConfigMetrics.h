@@ -0,0 +1,52 @@
+#ifndef __CONFIGMETRICS_H__
+#define __CONFIGMETRICS_H__
+
+#include <Arduino.h>
+
+// Latency buckets, from 1ms up to 1s, the last one is the +Inf bucket.
+#define METRICS_BUCKETS 8
+
+enum MetricsRoute {
+  routeConfigGet,
+  routeConfigPost,
+  routeScan,
+  routeSettingsGet,
+  routeSettingsPut,
+  routeSchema,
+  routeRegionGet,
+  routeRegionPut,
+  routeNotFound,
+  routeCount
+};
+
+/**
+ * Latency Histogram
+ *
+ * Plain counters, updated from loop() only. Each observation costs a few
+ * compares and adds.
+ */
+struct LatencyHistogram {
+  uint32_t buckets[METRICS_BUCKETS];
+  uint32_t count;
+  uint64_t sumMicros;
+
+  void observe(uint32_t micros);
+  size_t print(Print& out,
+               const __FlashStringHelper* name,
+               const char* labels);
+};
+
+/**
+ * Config Metrics
+ */
+struct ConfigMetrics {
+  LatencyHistogram routes[routeCount];
+  LatencyHistogram commits;
+  uint32_t redirects;
+  uint32_t wifiAttempts;
+  uint32_t wifiReconnects;
+
+  ConfigMetrics() { memset(this, 0, sizeof(*this)); }
+};
+
+#endif /* __CONFIGMETRICS_H__ */
@@ -0,0 +1,198 @@
+#include "ConfigScheduler.h"
+
+bool TaskScheduler::add(const char* name,
+                        uint8_t priority,
+                        unsigned long interval,
+                        std::function<void()> fn) {
+  if (count == SCHEDULER_MAX_TASKS) {
+    return false;
+  }
+
+  Task& task = tasks[count];
+  task.name = name;
+  task.priority = priority;
+  task.interval = interval;
+  task.lastRun = 0;
+  task.deferred = false;
+  task.fn = fn;
+  task.runs = 0;
+  task.deferrals = 0;
+  task.minMicros = 0;
+  task.maxMicros = 0;
+  task.totalMicros = 0;
+  memset(task.histogram, 0, sizeof(task.histogram));
+
+  order[count] = count;
+  count++;
+  sort();
+  return true;
+}
+
+void TaskScheduler::run() {
+  unsigned long start = micros();
+  unsigned long now = millis();
+  bool ran = false;
+
+  // Tasks deferred on the last call go first, then the rest.
+  bool deferred[SCHEDULER_MAX_TASKS];
+  for (size_t i = 0; i < count; i++) {
+    deferred[i] = tasks[i].deferred;
+  }
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t i = 0; i < count; i++) {
+      Task& task = tasks[order[i]];
+      if (deferred[order[i]] != (pass == 0)) {
+        continue;
+      }
+      if (task.interval > 0 && now - task.lastRun < task.interval) {
+        continue;
+      }
+
+      // At least one task runs on every call, whatever the budget.
+      if (budget > 0 && ran && micros() - start >= budget) {
+        task.deferred = true;
+        task.deferrals++;
+        continue;
+      }
+
+      runTask(task, now);
+      ran = true;
+    }
+  }
+}
+
+void TaskScheduler::setBudget(unsigned long micros) {
+  this->budget = micros;
+}
+
+bool TaskScheduler::setPriority(const char* name, uint8_t priority) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(tasks[i].name, name) == 0) {
+      tasks[i].priority = priority;
+      sort();
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t TaskScheduler::size() {
+  return count;
+}
+
+TaskStats TaskScheduler::getStats(size_t index) {
+  TaskStats stats;
+  memset(&stats, 0, sizeof(stats));
+  if (index >= count) {
+    return stats;
+  }
+
+  Task& task = tasks[index];
+  stats.name = task.name;
+  stats.priority = task.priority;
+  stats.runs = task.runs;
+  stats.deferrals = task.deferrals;
+  if (task.runs == 0) {
+    return stats;
+  }
+
+  stats.minMicros = task.minMicros;
+  stats.maxMicros = task.maxMicros;
+  stats.avgMicros = task.totalMicros / task.runs;
+
+  uint32_t total = 0;
+  for (size_t b = 0; b < TASK_HISTOGRAM_BUCKETS; b++) {
+    total += task.histogram[b];
+  }
+
+  // The first bucket that holds 99% of the runs.
+  uint32_t target = total - total / 100;
+  uint32_t seen = 0;
+  for (size_t b = 0; b < TASK_HISTOGRAM_BUCKETS; b++) {
+    seen += task.histogram[b];
+    if (seen >= target) {
+      uint32_t limit = bucketLimit(b);
+      stats.p99Micros = limit < task.maxMicros ? limit : task.maxMicros;
+      break;
+    }
+  }
+  return stats;
+}
+
+void TaskScheduler::resetStats() {
+  for (size_t i = 0; i < count; i++) {
+    Task& task = tasks[i];
+    task.runs = 0;
+    task.deferrals = 0;
+    task.minMicros = 0;
+    task.maxMicros = 0;
+    task.totalMicros = 0;
+    memset(task.histogram, 0, sizeof(task.histogram));
+  }
+}
+
+void TaskScheduler::sort() {
+  // Insertion sort, stable so equal priorities keep the order they were
+  // added in.
+  for (size_t i = 1; i < count; i++) {
+    uint8_t index = order[i];
+    size_t j = i;
+    for (; j > 0 && tasks[order[j - 1]].priority < tasks[index].priority;
+         j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = index;
+  }
+}
+
+void TaskScheduler::runTask(Task& task, unsigned long now) {
+  unsigned long start = micros();
+  task.fn();
+  record(task, micros() - start);
+
+  task.lastRun = now;
+  task.deferred = false;
+}
+
+void TaskScheduler::record(Task& task, uint32_t micros) {
+  if (task.runs == 0 || micros < task.minMicros) {
+    task.minMicros = micros;
+  }
+  if (micros > task.maxMicros) {
+    task.maxMicros = micros;
+  }
+  task.runs++;
+  task.totalMicros += micros;
+
+  size_t b = bucket(micros);
+  if (task.histogram[b] == UINT16_MAX) {
+    // Halve every bucket, the distribution stays the same.
+    for (size_t i = 0; i < TASK_HISTOGRAM_BUCKETS; i++) {
+      task.histogram[i] /= 2;
+    }
+  }
+  task.histogram[b]++;
+}
+
+size_t TaskScheduler::bucket(uint32_t micros) {
+  if (micros < 2) {
+    return 0;
+  }
+
+  // Two buckets per power of two, split on the bit below the highest.
+  size_t octave = 31 - __builtin_clz(micros);
+  size_t b = octave * 2 + ((micros >> (octave - 1)) & 1);
+  return b < TASK_HISTOGRAM_BUCKETS ? b : TASK_HISTOGRAM_BUCKETS - 1;
+}
+
+uint32_t TaskScheduler::bucketLimit(size_t bucket) {
+  if (bucket < 2) {
+    return 1;
+  }
+
+  size_t octave = bucket / 2;
+  uint32_t base = (uint32_t)1 << octave;
+  uint32_t half = base >> 1;
+  return base + half * (bucket % 2 + 1) - 1;
+}
@@ -0,0 +1,85 @@
+#ifndef __CONFIGSCHEDULER_H__
+#define __CONFIGSCHEDULER_H__
+
+#include <Arduino.h>
+
+#include <functional>
+
+// Maximum number of tasks, including the built-in ones.
+#ifndef SCHEDULER_MAX_TASKS
+#define SCHEDULER_MAX_TASKS 10
+#endif
+
+// Two histogram buckets per power of two, from 1us up to about 1s.
+#define TASK_HISTOGRAM_BUCKETS 40
+
+/**
+ * Task Stats
+ *
+ * Execution times in microseconds. The p99 is taken from a histogram and
+ * is accurate to within a bucket, about 40% of the value.
+ */
+struct TaskStats {
+  const char* name;
+  uint8_t priority;
+  uint32_t runs;
+  uint32_t deferrals;  // times the task was due but the budget was spent
+  uint32_t minMicros;
+  uint32_t avgMicros;
+  uint32_t maxMicros;
+  uint32_t p99Micros;
+};
+
+/**
+ * Task Scheduler
+ *
+ * Runs tasks cooperatively, highest priority first, until the per call time
+ * budget is spent. Tasks are never interrupted, so a single slow task can
+ * overrun the budget. Tasks deferred by the budget go first on the next
+ * call, so low priorities are delayed but never starved.
+ */
+class TaskScheduler {
+ public:
+  bool add(const char* name,
+           uint8_t priority,
+           unsigned long interval,
+           std::function<void()> fn);
+  void run();
+  void setBudget(unsigned long micros);
+  bool setPriority(const char* name, uint8_t priority);
+
+  size_t size();
+  TaskStats getStats(size_t index);
+  void resetStats();
+
+ private:
+  struct Task {
+    const char* name;
+    uint8_t priority;
+    unsigned long interval;  // milliseconds between runs, 0 runs every call
+    unsigned long lastRun;
+    bool deferred;
+    std::function<void()> fn;
+
+    uint32_t runs;
+    uint32_t deferrals;
+    uint32_t minMicros;
+    uint32_t maxMicros;
+    uint64_t totalMicros;
+    uint16_t histogram[TASK_HISTOGRAM_BUCKETS];
+  };
+
+  Task tasks[SCHEDULER_MAX_TASKS];
+  // Task indices, highest priority first.
+  uint8_t order[SCHEDULER_MAX_TASKS];
+  size_t count = 0;
+  unsigned long budget = 0;
+
+  void sort();
+  void runTask(Task& task, unsigned long now);
+  void record(Task& task, uint32_t micros);
+  static size_t bucket(uint32_t micros);
+  static uint32_t bucketLimit(size_t bucket);
+};
+
+#endif /* __CONFIGSCHEDULER_H__ */
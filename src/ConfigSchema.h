@@ -0,0 +1,397 @@
+#ifndef __CONFIGSCHEMA_H__
+#define __CONFIGSCHEMA_H__
+
+#include <type_traits>
+
+#include "ConfigManager.h"
+
+/**
+ * Describes a field of the config struct for a ConfigSchema.
+ *
+ *   CONFIG_FIELD(Config, name, both);
+ *   CONFIG_FIELD_RANGE(Config, hour, both, 0, 23, 6);
+ *
+ * declares the field types Config_name and Config_hour. Names are kept in
+ * flash. Range fields reject values outside [min, max] and are cleared to
+ * their default.
+ */
+#define CONFIG_FIELD(Struct, member, mode)                                   \
+  struct Struct##_##member : SchemaField<Struct, decltype(Struct::member), \
+                                         &Struct::member, mode> {         \
+    static const char* name() { return PSTR(#member); }                    \
+  }
+
+#define CONFIG_FIELD_RANGE(Struct, member, mode, minValue, maxValue,        \
+                           defaultValue)                                    \
+  struct Struct##_##member : SchemaField<Struct, decltype(Struct::member), \
+                                         &Struct::member, mode> {         \
+    static const char* name() { return PSTR(#member); }                    \
+    static const bool ranged = true;                                        \
+    static double min() { return minValue; }                                \
+    static double max() { return maxValue; }                                \
+    static double initial() { return defaultValue; }                        \
+  }
+
+// Writes a MessagePack string header and a name stored in flash.
+inline size_t printMsgPackName(Print& out, const char* name) {
+  size_t length = strlen_P(name);
+  size_t n;
+  if (length < 32) {
+    n = out.write((uint8_t)(0xA0 | length));
+  } else {
+    n = out.write((uint8_t)0xD9);
+    n += out.write((uint8_t)length);
+  }
+  return n + out.print(FPSTR(name));
+}
+
+/**
+ * Schema Value
+ *
+ * Serialization of a single field value, resolved by type at compile time.
+ */
+template <typename T>
+struct SchemaValue {
+  static_assert(std::is_arithmetic<T>::value,
+                "Schema fields must be arithmetic or char arrays");
+
+  // Bytes a parsed value takes outside the document slots.
+  static const size_t bytes = 0;
+
+  static const char* type() {
+    return std::is_same<T, bool>::value
+               ? PSTR("bool")
+               : std::is_floating_point<T>::value ? PSTR("float")
+                                                  : PSTR("int");
+  }
+
+  static size_t print(Print& out, const T& value) {
+    StaticJsonDocument<16> doc;
+    doc.set(value);
+    return serializeJson(doc, out);
+  }
+
+  static size_t printMsgPack(Print& out, const T& value) {
+    StaticJsonDocument<16> doc;
+    doc.set(value);
+    return serializeMsgPack(doc, out);
+  }
+
+  static bool parse(JsonVariant json,
+                    T& value,
+                    bool ranged,
+                    double min,
+                    double max) {
+    if (!acceptsJson<T>(json)) {
+      return false;
+    }
+
+    const T newValue = json.as<T>();
+    if ((ranged && (newValue < min || newValue > max)) || newValue == value) {
+      return false;
+    }
+
+    value = newValue;
+    return true;
+  }
+
+  static void clear(T& value, double initial) { value = (T)initial; }
+};
+
+template <size_t N>
+struct SchemaValue<char[N]> {
+  static const size_t bytes = N;
+
+  static const char* type() { return PSTR("string"); }
+
+  static size_t print(Print& out, const char (&value)[N]) {
+    StaticJsonDocument<16> doc;
+    doc.set((const char*)value);
+    return serializeJson(doc, out);
+  }
+
+  static size_t printMsgPack(Print& out, const char (&value)[N]) {
+    StaticJsonDocument<16> doc;
+    doc.set((const char*)value);
+    return serializeMsgPack(doc, out);
+  }
+
+  static bool parse(JsonVariant json, char (&value)[N], bool, double, double) {
+    // Strings that do not fit are rejected rather than cut.
+    const char* newValue = json.as<const char*>();
+    if (!newValue || strlen(newValue) >= N ||
+        strncmp(value, newValue, N) == 0) {
+      return false;
+    }
+
+    memset(value, 0, N);
+    strncpy(value, newValue, N - 1);
+    return true;
+  }
+
+  static void clear(char (&value)[N], double) { memset(value, 0, N); }
+};
+
+/**
+ * Schema Field
+ *
+ * Base of the field types declared by CONFIG_FIELD.
+ */
+template <typename C, typename T, T C::*Member, ParameterMode Mode>
+struct SchemaField {
+  typedef C Struct;
+  typedef T Type;
+  typedef SchemaValue<T> Value;
+
+  static const ParameterMode mode = Mode;
+  static const bool ranged = false;
+
+  static double min() { return 0; }
+  static double max() { return 0; }
+  static double initial() { return 0; }
+
+  static T& ref(C& config) { return config.*Member; }
+  static const T& ref(const C& config) { return config.*Member; }
+  static size_t offset(const C& config) {
+    return (const uint8_t*)&(config.*Member) - (const uint8_t*)&config;
+  }
+};
+
+/**
+ * Schema Field Access
+ *
+ * Mode filtering, fields that cannot be read or written compile to nothing.
+ */
+template <typename Field, bool Readable = Field::mode != set>
+struct SchemaRead {
+  static size_t printJson(Print& out,
+                          const typename Field::Struct& config,
+                          bool& first) {
+    size_t n = out.print(first ? F("\"") : F(",\""));
+    first = false;
+    n += out.print(FPSTR(Field::name()));
+    n += out.print(F("\":"));
+    return n + Field::Value::print(out, Field::ref(config));
+  }
+
+  static size_t printMsgPack(Print& out, const typename Field::Struct& config) {
+    size_t n = printMsgPackName(out, Field::name());
+    return n + Field::Value::printMsgPack(out, Field::ref(config));
+  }
+
+  static size_t count() { return 1; }
+};
+
+template <typename Field>
+struct SchemaRead<Field, false> {
+  static size_t printJson(Print&, const typename Field::Struct&, bool&) {
+    return 0;
+  }
+  static size_t printMsgPack(Print&, const typename Field::Struct&) {
+    return 0;
+  }
+  static size_t count() { return 0; }
+};
+
+template <typename Field, bool Writable = Field::mode != get>
+struct SchemaWrite {
+  static bool apply(typename Field::Struct& config, JsonVariant value) {
+    return Field::Value::parse(value, Field::ref(config), Field::ranged,
+                               Field::min(), Field::max());
+  }
+
+  static size_t filter(JsonObject* filter, size_t* count) {
+    if (filter) {
+      (*filter)[FPSTR(Field::name())] = true;
+    }
+    (*count)++;
+    return strlen_P(Field::name()) + 1 + Field::Value::bytes;
+  }
+};
+
+template <typename Field>
+struct SchemaWrite<Field, false> {
+  static bool apply(typename Field::Struct&, JsonVariant) { return false; }
+  static size_t filter(JsonObject*, size_t*) { return 0; }
+};
+
+/**
+ * Config Schema
+ *
+ * Compile time description of a config struct. The serialize, parse and
+ * clear routines are generated per field, without virtual dispatch.
+ *
+ *   typedef ConfigSchema<Config, Config_name, Config_hour> Schema;
+ *   configManager.begin<Schema>(config);
+ */
+template <typename C, typename... Fields>
+struct ConfigSchema;
+
+template <typename C>
+struct ConfigSchema<C> {
+  typedef C Type;
+
+  static size_t printFields(Print&, const C&, bool&) { return 0; }
+  static size_t printMsgPackFields(Print&, const C&) { return 0; }
+  static bool applyField(C&,
+                         const char*,
+                         JsonVariant,
+                         size_t*,
+                         size_t*,
+                         bool*) {
+    return false;
+  }
+  static void clearFields(C&) {}
+  static size_t printFieldSchema(Print&, bool) { return 0; }
+  static bool fieldAt(const C&, size_t, const char**, size_t*, size_t*) {
+    return false;
+  }
+
+  // Entry points used by ConfigManager.
+  static size_t printJson(Print&, const void*, bool&) { return 0; }
+  static size_t printMsgPack(Print&, const void*) { return 0; }
+  static size_t readable() { return 0; }
+  static size_t filter(JsonObject*, size_t*) { return 0; }
+  static int fromJson(void*, const char*, JsonVariant, size_t*, size_t*) {
+    return -1;
+  }
+  static bool field(const void*, size_t, const char**, size_t*, size_t*) {
+    return false;
+  }
+  static void clear(void*) {}
+  static size_t printSchema(Print& out) { return out.print(F("[]")); }
+};
+
+template <typename C, typename Field, typename... Rest>
+struct ConfigSchema<C, Field, Rest...> {
+  static_assert(std::is_same<typename Field::Struct, C>::value,
+                "Schema field does not belong to the config struct");
+
+  typedef C Type;
+  typedef ConfigSchema<C, Rest...> Next;
+
+  static size_t printFields(Print& out, const C& config, bool& first) {
+    size_t n = SchemaRead<Field>::printJson(out, config, first);
+    return n + Next::printFields(out, config, first);
+  }
+
+  static size_t printMsgPackFields(Print& out, const C& config) {
+    size_t n = SchemaRead<Field>::printMsgPack(out, config);
+    return n + Next::printMsgPackFields(out, config);
+  }
+
+  // Returns true when the key names a field, changed reports whether the
+  // value was applied.
+  static bool applyField(C& config,
+                         const char* key,
+                         JsonVariant value,
+                         size_t* offset,
+                         size_t* size,
+                         bool* changed) {
+    if (strcmp_P(key, Field::name()) != 0) {
+      return Next::applyField(config, key, value, offset, size, changed);
+    }
+
+    *changed = SchemaWrite<Field>::apply(config, value);
+    *offset = Field::offset(config);
+    *size = sizeof(typename Field::Type);
+    return true;
+  }
+
+  static void clearFields(C& config) {
+    Field::Value::clear(Field::ref(config), Field::initial());
+    Next::clearFields(config);
+  }
+
+  static bool fieldAt(const C& config,
+                      size_t index,
+                      const char** name,
+                      size_t* offset,
+                      size_t* size) {
+    if (index > 0) {
+      return Next::fieldAt(config, index - 1, name, offset, size);
+    }
+
+    *name = Field::name();
+    *offset = Field::offset(config);
+    *size = sizeof(typename Field::Type);
+    return true;
+  }
+
+  static size_t printFieldSchema(Print& out, bool first) {
+    size_t n = out.print(first ? F("{\"name\":\"") : F(",{\"name\":\""));
+    n += out.print(FPSTR(Field::name()));
+    n += out.print(F("\",\"type\":\""));
+    n += out.print(FPSTR(Field::Value::type()));
+    n += out.print(Field::mode == get
+                       ? F("\",\"mode\":\"get\"")
+                       : Field::mode == set ? F("\",\"mode\":\"set\"")
+                                            : F("\",\"mode\":\"both\""));
+    n += out.print(F(",\"size\":"));
+    n += out.print((unsigned long)sizeof(typename Field::Type));
+    if (Field::ranged) {
+      n += out.print(F(",\"min\":"));
+      n += out.print(Field::min());
+      n += out.print(F(",\"max\":"));
+      n += out.print(Field::max());
+      n += out.print(F(",\"default\":"));
+      n += out.print(Field::initial());
+    }
+    n += out.print('}');
+    return n + Next::printFieldSchema(out, false);
+  }
+
+  // Entry points used by ConfigManager.
+  static size_t printJson(Print& out, const void* config, bool& first) {
+    return printFields(out, *(const C*)config, first);
+  }
+
+  static size_t printMsgPack(Print& out, const void* config) {
+    return printMsgPackFields(out, *(const C*)config);
+  }
+
+  // Number of fields that can be read.
+  static size_t readable() {
+    return SchemaRead<Field>::count() + Next::readable();
+  }
+
+  // Adds the writable fields to a deserialization filter, when given, and
+  // counts them. Returns the bytes their keys and values take in a parsed
+  // document.
+  static size_t filter(JsonObject* filter, size_t* count) {
+    size_t n = SchemaWrite<Field>::filter(filter, count);
+    return n + Next::filter(filter, count);
+  }
+
+  static int fromJson(void* config,
+                      const char* key,
+                      JsonVariant value,
+                      size_t* offset,
+                      size_t* size) {
+    bool changed = false;
+    if (!applyField(*(C*)config, key, value, offset, size, &changed)) {
+      return -1;
+    }
+    return changed ? 1 : 0;
+  }
+
+  static void clear(void* config) { clearFields(*(C*)config); }
+
+  // Name, in flash, offset and size of the field at index, false past the
+  // last field.
+  static bool field(const void* config,
+                    size_t index,
+                    const char** name,
+                    size_t* offset,
+                    size_t* size) {
+    return fieldAt(*(const C*)config, index, name, offset, size);
+  }
+
+  static size_t printSchema(Print& out) {
+    size_t n = out.print('[');
+    n += printFieldSchema(out, true);
+    return n + out.print(']');
+  }
+};
+
+#endif /* __CONFIGSCHEMA_H__ */
@@ -0,0 +1,743 @@
+#include "ConfigServer.h"
+
+static const char* reasonPhrase(int code) {
+  switch (code) {
+    case 200:
+      return "OK";
+    case 202:
+      return "Accepted";
+    case 204:
+      return "No Content";
+    case 302:
+      return "Found";
+    case 304:
+      return "Not Modified";
+    case 400:
+      return "Bad Request";
+    case 404:
+      return "Not Found";
+    case 411:
+      return "Length Required";
+    case 412:
+      return "Precondition Failed";
+    case 413:
+      return "Payload Too Large";
+    case 431:
+      return "Request Header Fields Too Large";
+    case 500:
+      return "Internal Server Error";
+    case 501:
+      return "Not Implemented";
+  }
+  return "";
+}
+
+// Offset just past the blank line that ends the head, 0 until it arrived.
+static size_t findHeadEnd(const char* head, size_t length) {
+  for (size_t i = 3; i < length; i++) {
+    if (head[i] == '\n' && head[i - 1] == '\r' && head[i - 2] == '\n' &&
+        head[i - 3] == '\r') {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// Value of a header in a head that was not parsed yet, NULL when missing.
+static const char* peekHeader(const char* head,
+                              size_t end,
+                              const char* name,
+                              size_t nameLength) {
+  for (size_t i = 0; i + nameLength + 3 < end; i++) {
+    if (head[i] == '\n' && strncasecmp(head + i + 1, name, nameLength) == 0 &&
+        head[i + 1 + nameLength] == ':') {
+      const char* value = head + i + 2 + nameLength;
+      while (*value == ' ') {
+        value++;
+      }
+      return value;
+    }
+  }
+  return NULL;
+}
+
+// Start of the CRLF that ends the line, NULL when none is before end.
+static char* findLineEnd(char* line, const char* end) {
+  for (char* at = line; at + 1 < end; at++) {
+    if (at[0] == '\r' && at[1] == '\n') {
+      return at;
+    }
+  }
+  return NULL;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+EventServer::EventServer(int port, size_t clients)
+    : listener(port), connections(new Connection[clients]), clients(clients) {
+  for (size_t i = 0; i < clients; i++) {
+    connections[i].state = connectionFree;
+    connections[i].headLength = 0;
+  }
+}
+
+void EventServer::begin() {
+  listener.begin();
+  listener.setNoDelay(true);
+}
+
+void EventServer::stop() {
+  for (size_t i = 0; i < clients; i++) {
+    if (connections[i].state != connectionFree) {
+      close(connections[i]);
+    }
+  }
+  listener.stop();
+}
+
+void EventServer::handleClient() {
+  accept();
+
+  // Every connection advances as far as its bytes allow, at most one
+  // request each per call.
+  for (size_t i = 0; i < clients; i++) {
+    if (connections[i].state != connectionFree) {
+      poll(connections[i]);
+    }
+  }
+}
+
+void EventServer::enableCORS(bool enable) {
+  cors = enable;
+}
+
+void EventServer::on(const String& uri,
+                     HTTPMethod method,
+                     THandlerFunction fn) {
+  if (routeCount == EVENT_SERVER_MAX_ROUTES) {
+    return;
+  }
+  routes[routeCount].uri = uri;
+  routes[routeCount].method = method;
+  routes[routeCount].fn = fn;
+  routeCount++;
+}
+
+void EventServer::onNotFound(THandlerFunction fn) {
+  notFound = fn;
+}
+
+// Every header is kept, there is nothing to collect.
+void EventServer::collectHeaders(const char* keys[], size_t count) {
+  (void)keys;
+  (void)count;
+}
+
+String EventServer::uri() {
+  return String(path);
+}
+
+HTTPMethod EventServer::method() {
+  return currentMethod;
+}
+
+String EventServer::arg(const String& name) {
+  if (!current) {
+    return String();
+  }
+  if (name == "plain") {
+    return current->body;
+  }
+
+  String value;
+  if (findArg(query, name.c_str(), &value)) {
+    return value;
+  }
+  const char* type = findHeader("Content-Type");
+  if (type && strncmp(type, "application/x-www-form-urlencoded", 33) == 0) {
+    findArg(current->body.c_str(), name.c_str(), &value);
+  }
+  return value;
+}
+
+bool EventServer::hasArg(const String& name) {
+  if (!current) {
+    return false;
+  }
+  if (name == "plain") {
+    return current->body.length() > 0;
+  }
+  return findArg(query, name.c_str(), NULL) ||
+         findArg(current->body.c_str(), name.c_str(), NULL);
+}
+
+String EventServer::header(const String& name) {
+  const char* value = findHeader(name.c_str());
+  return String(value ? value : "");
+}
+
+String EventServer::hostHeader() {
+  return header("Host");
+}
+
+IPAddress EventServer::localIP() {
+  return current ? current->client.localIP() : IPAddress();
+}
+
+const char* EventServer::uriCStr() {
+  return path;
+}
+
+const char* EventServer::hostHeaderCStr() {
+  const char* value = findHeader("Host");
+  return value ? value : "";
+}
+
+void EventServer::setContentLength(size_t length) {
+  contentLength = length;
+}
+
+void EventServer::sendHeader(const String& name,
+                             const String& value,
+                             bool first) {
+  size_t length = name.length() + value.length() + 4;
+  if (extraLength + length >= sizeof(extraHeaders)) {
+    return;
+  }
+
+  char* at = extraHeaders + extraLength;
+  if (first) {
+    memmove(extraHeaders + length, extraHeaders, extraLength);
+    at = extraHeaders;
+  }
+  memcpy(at, name.c_str(), name.length());
+  memcpy(at + name.length(), ": ", 2);
+  memcpy(at + name.length() + 2, value.c_str(), value.length());
+  memcpy(at + length - 2, "\r\n", 2);
+  extraLength += length;
+}
+
+void EventServer::send(int code,
+                       const String& contentType,
+                       const String& content) {
+  if (!current || headersSent) {
+    return;
+  }
+
+  size_t length = contentLength;
+  if (length == CONTENT_LENGTH_NOT_SET) {
+    length = content.length();
+  }
+  size_t n = writeHead(code, contentType, length);
+  if (chunked) {
+    write(buffer, n);
+    if (content.length() > 0) {
+      sendContent(content.c_str(), content.length());
+    }
+    return;
+  }
+
+  // Small responses go out in a single write.
+  if (currentMethod == HTTP_HEAD || code == 204 || code == 304) {
+    write(buffer, n);
+  } else if (n + content.length() <= sizeof(buffer)) {
+    memcpy(buffer + n, content.c_str(), content.length());
+    write(buffer, n + content.length());
+  } else {
+    write(buffer, n);
+    write(content.c_str(), content.length());
+  }
+}
+
+void EventServer::send_P(int code,
+                         PGM_P contentType,
+                         PGM_P content,
+                         size_t length) {
+  if (!current || headersSent) {
+    return;
+  }
+
+  size_t n = writeHead(code, FPSTR(contentType), length);
+  if (currentMethod == HTTP_HEAD) {
+    write(buffer, n);
+    return;
+  }
+  while (length > 0) {
+    size_t count = min(length, sizeof(buffer) - n);
+    memcpy_P(buffer + n, content, count);
+    write(buffer, n + count);
+    content += count;
+    length -= count;
+    n = 0;
+  }
+  if (n > 0) {
+    write(buffer, n);
+  }
+}
+
+void EventServer::sendContent(const char* content, size_t length) {
+  if (!current || !headersSent) {
+    return;
+  }
+  if (!chunked) {
+    if (length > 0) {
+      write(content, length);
+    }
+    return;
+  }
+
+  // An empty chunk ends the response.
+  if (length == 0) {
+    write("0\r\n\r\n", 5);
+    finished = true;
+    return;
+  }
+
+  int n = snprintf(buffer, sizeof(buffer), "%x\r\n", (unsigned int)length);
+  if (n + length + 2 <= sizeof(buffer)) {
+    memcpy(buffer + n, content, length);
+    memcpy(buffer + n + length, "\r\n", 2);
+    write(buffer, n + length + 2);
+  } else {
+    write(buffer, n);
+    write(content, length);
+    write("\r\n", 2);
+  }
+}
+
+size_t EventServer::streamFile(File& file, const String& contentType) {
+  if (!current || headersSent) {
+    return 0;
+  }
+
+  // Like the cores, gzip files are sent with their content encoding.
+  const char* name = file.name();
+  size_t nameLength = strlen(name);
+  if (nameLength > 3 && strcmp(name + nameLength - 3, ".gz") == 0) {
+    sendHeader(F("Content-Encoding"), F("gzip"));
+  }
+
+  size_t n = writeHead(200, contentType, file.size());
+  write(buffer, n);
+  if (currentMethod == HTTP_HEAD) {
+    return 0;
+  }
+
+  size_t total = 0;
+  size_t count;
+  while ((count = file.read((uint8_t*)buffer, sizeof(buffer))) > 0) {
+    write(buffer, count);
+    total += count;
+  }
+  return total;
+}
+
+void EventServer::sendRaw(const char* data, size_t length) {
+  if (!current) {
+    return;
+  }
+  write(data, length);
+  close(*current);
+  current = NULL;
+}
+
+size_t EventServer::getConnections() {
+  size_t open = 0;
+  for (size_t i = 0; i < clients; i++) {
+    if (connections[i].state != connectionFree) {
+      open++;
+    }
+  }
+  return open;
+}
+
+uint32_t EventServer::getRequests() {
+  return requests;
+}
+
+//
+// EventServer Connections
+//
+void EventServer::accept() {
+  for (size_t i = 0; i < clients; i++) {
+    Connection& c = connections[i];
+    if (c.state != connectionFree) {
+      continue;
+    }
+
+    // Clients beyond the free slots wait in the listener's backlog.
+    WiFiClient client = listener.available();
+    if (!client) {
+      return;
+    }
+    client.setNoDelay(true);
+    c.client = client;
+    c.state = connectionHead;
+    c.headLength = 0;
+    c.requests = 0;
+    c.lastActivity = millis();
+  }
+}
+
+void EventServer::poll(Connection& c) {
+  if (!c.client.connected() && c.client.available() == 0) {
+    close(c);
+    return;
+  }
+
+  bool progress = c.state == connectionHead ? readHead(c) : readBody(c);
+  if (progress) {
+    c.lastActivity = millis();
+  } else if (millis() - c.lastActivity > EVENT_SERVER_TIMEOUT) {
+    close(c);
+  }
+}
+
+bool EventServer::readHead(Connection& c) {
+  // Bytes pipelined behind the previous request may hold a whole head.
+  size_t end = findHeadEnd(c.head, c.headLength);
+  if (end == 0) {
+    size_t space = sizeof(c.head) - c.headLength;
+    if (space == 0) {
+      fail(c, 431);
+      return true;
+    }
+    int available = c.client.available();
+    if (available <= 0) {
+      return false;
+    }
+
+    int n = c.client.read((uint8_t*)c.head + c.headLength,
+                          min((size_t)available, space));
+    if (n <= 0) {
+      return false;
+    }
+    // Only the new bytes and the three before them can end the head.
+    size_t from = c.headLength > 3 ? c.headLength - 3 : 0;
+    c.headLength += n;
+    end = findHeadEnd(c.head + from, c.headLength - from);
+    if (end == 0) {
+      return true;
+    }
+    end += from;
+  }
+
+  if (peekHeader(c.head, end, "Transfer-Encoding", 17)) {
+    fail(c, 411);
+    return true;
+  }
+  const char* length = peekHeader(c.head, end, "Content-Length", 14);
+  c.bodyLength = length ? strtoul(length, NULL, 10) : 0;
+  if (c.bodyLength > EVENT_SERVER_MAX_BODY) {
+    fail(c, 413);
+    return true;
+  }
+
+  c.body = String();
+  size_t have = min(c.headLength - end, c.bodyLength);
+  if (c.bodyLength > 0) {
+    // The body is read whole, refuse it when the heap cannot hold it.
+    if (!c.body.reserve(c.bodyLength)) {
+      fail(c, 413);
+      return true;
+    }
+    c.body.concat(c.head + end, have);
+  }
+  c.headEnd = end;
+  c.consumed = end + have;
+  if (have < c.bodyLength) {
+    c.state = connectionBody;
+    return true;
+  }
+
+  dispatch(c);
+  return true;
+}
+
+bool EventServer::readBody(Connection& c) {
+  int available = c.client.available();
+  if (available <= 0) {
+    return false;
+  }
+
+  size_t missing = c.bodyLength - c.body.length();
+  int n = c.client.read((uint8_t*)buffer,
+                        min(min((size_t)available, missing), sizeof(buffer)));
+  if (n <= 0) {
+    return false;
+  }
+  c.body.concat(buffer, n);
+
+  if (c.body.length() == c.bodyLength) {
+    dispatch(c);
+  }
+  return true;
+}
+
+// Splits the head in place, the request fields point into it. Heads with
+// NUL bytes or without a request line are malformed.
+bool EventServer::parseHead(Connection& c) {
+  char* line = c.head;
+  char* end = c.head + c.headEnd - 2;
+  if (memchr(line, '\0', end - line)) {
+    return false;
+  }
+
+  char* next = findLineEnd(line, end);
+  if (!next) {
+    return false;
+  }
+  *next = '\0';
+  *end = '\0';
+
+  char* target = strchr(line, ' ');
+  if (!target) {
+    return false;
+  }
+  *target++ = '\0';
+  char* version = strchr(target, ' ');
+  if (!version) {
+    return false;
+  }
+  *version++ = '\0';
+
+  static const struct {
+    const char* name;
+    HTTPMethod method;
+  } methods[] = {{"GET", HTTP_GET},         {"HEAD", HTTP_HEAD},
+                 {"POST", HTTP_POST},       {"PUT", HTTP_PUT},
+                 {"PATCH", HTTP_PATCH},     {"DELETE", HTTP_DELETE},
+                 {"OPTIONS", HTTP_OPTIONS}};
+  size_t m = 0;
+  for (; m < sizeof(methods) / sizeof(methods[0]); m++) {
+    if (strcmp(line, methods[m].name) == 0) {
+      break;
+    }
+  }
+  if (m == sizeof(methods) / sizeof(methods[0])) {
+    return false;
+  }
+  currentMethod = methods[m].method;
+
+  path = target;
+  char* args = strchr(target, '?');
+  if (args) {
+    *args++ = '\0';
+  }
+  query = args ? args : "";
+
+  // HTTP/1.1 keeps the connection by default, 1.0 only when asked.
+  http11 = strcmp(version, "HTTP/1.1") == 0;
+  keepAlive = http11;
+
+  headerCount = 0;
+  line = next + 2;
+  while (line < end) {
+    next = findLineEnd(line, end);
+    if (next) {
+      *next = '\0';
+    }
+
+    char* value = strchr(line, ':');
+    if (value && headerCount < EVENT_SERVER_MAX_HEADERS) {
+      *value++ = '\0';
+      while (*value == ' ') {
+        value++;
+      }
+      headerNames[headerCount] = line;
+      headerValues[headerCount] = value;
+      headerCount++;
+    }
+
+    if (!next) {
+      break;
+    }
+    line = next + 2;
+  }
+
+  const char* connection = findHeader("Connection");
+  if (connection) {
+    if (strcasecmp(connection, "close") == 0) {
+      keepAlive = false;
+    } else if (strcasecmp(connection, "keep-alive") == 0) {
+      keepAlive = true;
+    }
+  }
+  return true;
+}
+
+void EventServer::dispatch(Connection& c) {
+  if (!parseHead(c)) {
+    fail(c, 400);
+    return;
+  }
+
+  current = &c;
+  contentLength = CONTENT_LENGTH_NOT_SET;
+  extraLength = 0;
+  headersSent = false;
+  chunked = false;
+  finished = false;
+  requests++;
+  c.requests++;
+  if (c.requests >= EVENT_SERVER_MAX_REQUESTS) {
+    keepAlive = false;
+  }
+
+  bool handled = false;
+  for (size_t i = 0; i < routeCount && !handled; i++) {
+    Route& route = routes[i];
+    if ((route.method == HTTP_ANY || route.method == currentMethod) &&
+        route.uri == path) {
+      route.fn();
+      handled = true;
+    }
+  }
+  if (!handled) {
+    if (notFound) {
+      notFound();
+    } else {
+      send(404, "text/plain", "Not Found");
+    }
+  }
+
+  // The handler closed it itself.
+  if (!current) {
+    return;
+  }
+  current = NULL;
+  path = "";
+  query = "";
+  headerCount = 0;
+
+  // Unfinished responses have no end the client could find.
+  if (!keepAlive || !finished) {
+    close(c);
+    return;
+  }
+
+  // Keep what was pipelined behind this request.
+  c.headLength -= c.consumed;
+  memmove(c.head, c.head + c.consumed, c.headLength);
+  c.body = String();
+  c.state = connectionHead;
+}
+
+void EventServer::fail(Connection& c, int code) {
+  int n = snprintf(buffer, sizeof(buffer),
+                   "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n"
+                   "Connection: close\r\n\r\n",
+                   code, reasonPhrase(code));
+  c.client.write((const uint8_t*)buffer, n);
+  close(c);
+}
+
+void EventServer::close(Connection& c) {
+  c.client.stop();
+  c.state = connectionFree;
+  c.headLength = 0;
+  c.body = String();
+}
+
+//
+// EventServer Responses
+//
+const char* EventServer::findHeader(const char* name) {
+  for (size_t i = 0; i < headerCount; i++) {
+    if (strcasecmp(headerNames[i], name) == 0) {
+      return headerValues[i];
+    }
+  }
+  return NULL;
+}
+
+// Formats the status line and headers into the buffer.
+size_t EventServer::writeHead(int code,
+                              const String& contentType,
+                              size_t length) {
+  headersSent = true;
+  // HTTP/1.0 has no chunks, the end of the body is the end of the
+  // connection.
+  chunked = length == CONTENT_LENGTH_UNKNOWN && http11;
+  if (length == CONTENT_LENGTH_UNKNOWN && !http11) {
+    keepAlive = false;
+  }
+  finished = !chunked;
+
+  int n = snprintf(buffer, sizeof(buffer), "HTTP/1.1 %d %s\r\n", code,
+                   reasonPhrase(code));
+  if (contentType.length() > 0) {
+    n += snprintf(buffer + n, sizeof(buffer) - n, "Content-Type: %s\r\n",
+                  contentType.c_str());
+  }
+  if (chunked) {
+    n += snprintf(buffer + n, sizeof(buffer) - n,
+                  "Transfer-Encoding: chunked\r\n");
+  } else if (length != CONTENT_LENGTH_UNKNOWN && code != 204 && code != 304) {
+    n += snprintf(buffer + n, sizeof(buffer) - n, "Content-Length: %u\r\n",
+                  (unsigned int)length);
+  }
+  if (cors) {
+    n += snprintf(buffer + n, sizeof(buffer) - n,
+                  "Access-Control-Allow-Origin: *\r\n"
+                  "Access-Control-Allow-Methods: *\r\n"
+                  "Access-Control-Allow-Headers: *\r\n");
+  }
+  n += snprintf(buffer + n, sizeof(buffer) - n, "Connection: %s\r\n",
+                keepAlive ? "keep-alive" : "close");
+
+  size_t total = min((size_t)n, sizeof(buffer) - 2);
+  size_t extra = min(extraLength, sizeof(buffer) - 2 - total);
+  memcpy(buffer + total, extraHeaders, extra);
+  total += extra;
+  memcpy(buffer + total, "\r\n", 2);
+  return total + 2;
+}
+
+void EventServer::write(const char* data, size_t length) {
+  current->client.write((const uint8_t*)data, length);
+}
+
+// Looks up name in a query string, decoding its value when found.
+bool EventServer::findArg(const char* args, const char* name, String* value) {
+  size_t nameLength = strlen(name);
+  while (*args) {
+    const char* end = strchr(args, '&');
+    if (!end) {
+      end = args + strlen(args);
+    }
+
+    if (strncmp(args, name, nameLength) == 0 &&
+        (args + nameLength == end || args[nameLength] == '=')) {
+      if (value) {
+        *value = String();
+        for (const char* p = args + nameLength + 1; p < end; p++) {
+          if (*p == '+') {
+            *value += ' ';
+          } else if (*p == '%' && p + 2 < end && hexValue(p[1]) >= 0 &&
+                     hexValue(p[2]) >= 0) {
+            *value += (char)(hexValue(p[1]) * 16 + hexValue(p[2]));
+            p += 2;
+          } else {
+            *value += *p;
+          }
+        }
+      }
+      return true;
+    }
+
+    args = *end ? end + 1 : end;
+  }
+  return false;
+}
@@ -0,0 +1,301 @@
+#ifndef __CONFIGSERVER_H__
+#define __CONFIGSERVER_H__
+
+#include <FS.h>
+
+#if defined(ARDUINO_ARCH_ESP8266)  // ESP8266
+#include <ESP8266WebServer.h>
+#include <ESP8266WiFi.h>
+#elif defined(ARDUINO_ARCH_ESP32)  // ESP32
+#include <WebServer.h>
+#include <WiFi.h>
+#endif
+
+#include <functional>
+#include <memory>
+
+#if defined(ARDUINO_ARCH_ESP8266)  // ESP8266
+using WebServer = ESP8266WebServer;
+#endif
+
+// Connections an EventServer serves at once.
+#ifndef EVENT_SERVER_CLIENTS
+#define EVENT_SERVER_CLIENTS 4
+#endif
+
+// Request line and headers of a single request, per connection.
+#ifndef EVENT_SERVER_HEAD_SIZE
+#define EVENT_SERVER_HEAD_SIZE 1024
+#endif
+
+// Largest request body read.
+#ifndef EVENT_SERVER_MAX_BODY
+#define EVENT_SERVER_MAX_BODY 8192
+#endif
+
+// Milliseconds an idle or stalled connection is kept open.
+#ifndef EVENT_SERVER_TIMEOUT
+#define EVENT_SERVER_TIMEOUT 5000
+#endif
+
+// Requests served on one connection before it is closed.
+#ifndef EVENT_SERVER_MAX_REQUESTS
+#define EVENT_SERVER_MAX_REQUESTS 100
+#endif
+
+#define EVENT_SERVER_MAX_HEADERS 24
+#define EVENT_SERVER_MAX_ROUTES 24
+#define EVENT_SERVER_BUFFER_SIZE 512
+#define EVENT_SERVER_EXTRA_HEADERS 256
+
+/**
+ * Config Server
+ *
+ * The HTTP server the built-in routes are registered on. The request and
+ * response calls mirror the synchronous WebServer, handlers work on the
+ * request being served.
+ */
+class ConfigServer {
+ public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  virtual ~ConfigServer() {}
+
+  virtual void begin() = 0;
+  virtual void stop() = 0;
+  virtual void handleClient() = 0;
+  virtual void enableCORS(bool enable) = 0;
+  virtual void on(const String& uri,
+                  HTTPMethod method,
+                  THandlerFunction fn) = 0;
+  virtual void onNotFound(THandlerFunction fn) = 0;
+  virtual void collectHeaders(const char* keys[], size_t count) = 0;
+
+  virtual String uri() = 0;
+  virtual HTTPMethod method() = 0;
+  virtual String arg(const String& name) = 0;
+  virtual bool hasArg(const String& name) = 0;
+  virtual String header(const String& name) = 0;
+  virtual String hostHeader() = 0;
+  virtual IPAddress localIP() = 0;
+  // The same without a String copy, valid until the handler returns.
+  virtual const char* uriCStr() = 0;
+  virtual const char* hostHeaderCStr() = 0;
+
+  virtual void setContentLength(size_t length) = 0;
+  virtual void sendHeader(const String& name,
+                          const String& value,
+                          bool first = false) = 0;
+  virtual void send(int code,
+                    const String& contentType,
+                    const String& content) = 0;
+  virtual void send_P(int code,
+                      PGM_P contentType,
+                      PGM_P content,
+                      size_t length) = 0;
+  virtual void sendContent(const char* content, size_t length) = 0;
+  virtual size_t streamFile(File& file, const String& contentType) = 0;
+  // Writes a complete response as is and closes the connection.
+  virtual void sendRaw(const char* data, size_t length) = 0;
+
+  // The WebServer behind the backend, NULL when there is none.
+  virtual WebServer* webServer() { return NULL; }
+
+  void send(int code,
+            const char* contentType = NULL,
+            const String& content = String("")) {
+    send(code, String(contentType ? contentType : ""), content);
+  }
+  void sendContent(const String& content) {
+    sendContent(content.c_str(), content.length());
+  }
+};
+
+/**
+ * Sync Server
+ *
+ * The synchronous WebServer of the core, one client at a time from
+ * handleClient().
+ */
+class SyncServer : public ConfigServer {
+ public:
+  SyncServer(int port) : server(port) {}
+
+  void begin() { server.begin(); }
+  void stop() { server.stop(); }
+  void handleClient() { server.handleClient(); }
+  void enableCORS(bool enable) { server.enableCORS(enable); }
+  void on(const String& uri, HTTPMethod method, THandlerFunction fn) {
+    server.on(uri, method, fn);
+  }
+  void onNotFound(THandlerFunction fn) { server.onNotFound(fn); }
+  void collectHeaders(const char* keys[], size_t count) {
+    server.collectHeaders(keys, count);
+  }
+
+  String uri() { return server.uri(); }
+  HTTPMethod method() { return server.method(); }
+  String arg(const String& name) { return server.arg(name); }
+  bool hasArg(const String& name) { return server.hasArg(name); }
+  String header(const String& name) { return server.header(name); }
+  String hostHeader() { return server.hostHeader(); }
+  IPAddress localIP() { return server.client().localIP(); }
+  const char* uriCStr() { return server.currentUri().c_str(); }
+  const char* hostHeaderCStr() { return server.currentHost().c_str(); }
+
+  void setContentLength(size_t length) { server.setContentLength(length); }
+  void sendHeader(const String& name,
+                  const String& value,
+                  bool first = false) {
+    server.sendHeader(name, value, first);
+  }
+  using ConfigServer::send;
+  void send(int code, const String& contentType, const String& content) {
+    server.send(code, contentType, content);
+  }
+  void send_P(int code, PGM_P contentType, PGM_P content, size_t length) {
+    server.send_P(code, contentType, content, length);
+  }
+  using ConfigServer::sendContent;
+  void sendContent(const char* content, size_t length) {
+    server.sendContent(content, length);
+  }
+  size_t streamFile(File& file, const String& contentType) {
+    return server.streamFile(file, contentType);
+  }
+  void sendRaw(const char* data, size_t length) {
+    server.client().write((const uint8_t*)data, length);
+    server.client().stop();
+  }
+
+  WebServer* webServer() { return &server; }
+
+ private:
+  // The cores only return copies of the request fields, their members are
+  // protected.
+  class Server : public WebServer {
+   public:
+    Server(int port) : WebServer(port) {}
+    const String& currentUri() { return _currentUri; }
+    const String& currentHost() { return _hostHeader; }
+  };
+
+  Server server;
+};
+
+/**
+ * Event Server
+ *
+ * Serves several connections at once from handleClient(), reading each
+ * one as far as its bytes have arrived. A client that sends slowly only
+ * holds up its own request. HTTP/1.1 connections are kept alive between
+ * requests. Handlers run from handleClient() like with the WebServer, so
+ * they need no locking. Responses are written synchronously when the
+ * handler sends them, a client that reads slowly holds up the others
+ * until its response is out.
+ */
+class EventServer : public ConfigServer {
+ public:
+  EventServer(int port, size_t clients = EVENT_SERVER_CLIENTS);
+
+  void begin();
+  void stop();
+  void handleClient();
+  void enableCORS(bool enable);
+  void on(const String& uri, HTTPMethod method, THandlerFunction fn);
+  void onNotFound(THandlerFunction fn);
+  void collectHeaders(const char* keys[], size_t count);
+
+  String uri();
+  HTTPMethod method();
+  String arg(const String& name);
+  bool hasArg(const String& name);
+  String header(const String& name);
+  String hostHeader();
+  IPAddress localIP();
+  const char* uriCStr();
+  const char* hostHeaderCStr();
+
+  void setContentLength(size_t length);
+  void sendHeader(const String& name,
+                  const String& value,
+                  bool first = false);
+  using ConfigServer::send;
+  void send(int code, const String& contentType, const String& content);
+  void send_P(int code, PGM_P contentType, PGM_P content, size_t length);
+  using ConfigServer::sendContent;
+  void sendContent(const char* content, size_t length);
+  size_t streamFile(File& file, const String& contentType);
+  void sendRaw(const char* data, size_t length);
+
+  // Connections open right now and requests served since begin().
+  size_t getConnections();
+  uint32_t getRequests();
+
+ private:
+  enum ConnectionState { connectionFree, connectionHead, connectionBody };
+
+  struct Connection {
+    WiFiClient client;
+    ConnectionState state;
+    char head[EVENT_SERVER_HEAD_SIZE];
+    size_t headLength;
+    size_t headEnd;   // where the body starts
+    size_t consumed;  // head bytes that belong to this request
+    String body;
+    size_t bodyLength;
+    unsigned long lastActivity;
+    uint16_t requests;
+  };
+
+  struct Route {
+    String uri;
+    HTTPMethod method;
+    THandlerFunction fn;
+  };
+
+  WiFiServer listener;
+  std::unique_ptr<Connection[]> connections;
+  size_t clients;
+  Route routes[EVENT_SERVER_MAX_ROUTES];
+  size_t routeCount = 0;
+  THandlerFunction notFound;
+  bool cors = false;
+  uint32_t requests = 0;
+
+  // The request being served, its fields point into the head buffer.
+  Connection* current = NULL;
+  HTTPMethod currentMethod = HTTP_GET;
+  const char* path = "";
+  const char* query = "";
+  const char* headerNames[EVENT_SERVER_MAX_HEADERS];
+  const char* headerValues[EVENT_SERVER_MAX_HEADERS];
+  size_t headerCount = 0;
+  bool http11 = false;
+  bool keepAlive = false;
+
+  // The response to it.
+  size_t contentLength = CONTENT_LENGTH_NOT_SET;
+  char extraHeaders[EVENT_SERVER_EXTRA_HEADERS];
+  size_t extraLength = 0;
+  bool headersSent = false;
+  bool chunked = false;
+  bool finished = false;
+  char buffer[EVENT_SERVER_BUFFER_SIZE];
+
+  void accept();
+  void poll(Connection& c);
+  bool readHead(Connection& c);
+  bool readBody(Connection& c);
+  bool parseHead(Connection& c);
+  void dispatch(Connection& c);
+  void fail(Connection& c, int code);
+  void close(Connection& c);
+
+  const char* findHeader(const char* name);
+  size_t writeHead(int code, const String& contentType, size_t length);
+  void write(const char* data, size_t length);
+  static bool findArg(const char* args, const char* name, String* value);
+};
+
+#endif /* __CONFIGSERVER_H__ */
@@ -0,0 +1,753 @@
+#include "ConfigManager.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <rom/crc.h>
+#endif
+
+#define JOURNAL_SECTOR_SIZE 4096
+#define JOURNAL_MAGIC 0x314A4D43  // "CMJ1"
+#define JOURNAL_CHUNK 64
+
+struct JournalSectorHeader {
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t size;
+  uint32_t crc;
+};
+
+struct JournalRecordHeader {
+  uint16_t offset;
+  uint16_t length;
+  uint32_t sequence;
+  uint32_t crc;
+};
+
+// Bytes of the record header covered by its CRC.
+#define JOURNAL_RECORD_CRC_LENGTH 8
+// Set in the offset of every record of a commit but the last.
+#define JOURNAL_MORE 0x8000
+#define JOURNAL_OFFSET_MASK 0x7FFF
+
+#define SLOT_MAGIC 0x31534D43  // "CMS1"
+
+struct SlotHeader {
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t size;
+  uint32_t dataCrc;
+  uint32_t crc;
+};
+
+#if !defined(ARDUINO_ARCH_ESP32)
+// CRC-32 (IEEE) lookup table for the reflected polynomial 0xEDB88320.
+static const uint32_t crcTable[256] PROGMEM = {
+    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba,
+    0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
+    0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+    0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
+    0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de,
+    0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec,
+    0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
+    0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+    0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
+    0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940,
+    0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116,
+    0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
+    0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+    0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
+    0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a,
+    0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818,
+    0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
+    0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+    0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
+    0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c,
+    0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2,
+    0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
+    0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+    0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
+    0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086,
+    0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4,
+    0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
+    0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+    0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
+    0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8,
+    0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe,
+    0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
+    0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+    0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
+    0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252,
+    0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60,
+    0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
+    0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+    0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
+    0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04,
+    0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a,
+    0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
+    0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+    0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
+    0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e,
+    0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c,
+    0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
+    0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+    0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
+    0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0,
+    0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6,
+    0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
+    0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d,
+};
+#endif
+
+static uint32_t crc32(const void* data, size_t length, uint32_t crc = 0) {
+#if defined(ARDUINO_ARCH_ESP32)
+  // The ROM implementation, same polynomial and chaining.
+  return crc32_le(crc, (const uint8_t*)data, length);
+#else
+  const uint8_t* ptr = (const uint8_t*)data;
+
+  crc = ~crc;
+  while (length--) {
+    crc = pgm_read_dword(&crcTable[(crc ^ *ptr++) & 0xFF]) ^ (crc >> 8);
+  }
+  return ~crc;
+#endif
+}
+
+static size_t align4(size_t length) {
+  return (length + 3) & ~(size_t)3;
+}
+
+//
+// EEPROM Storage
+//
+bool EEPROMStorage::begin(size_t size) {
+  EEPROM.begin(size);
+  // The cores refuse sizes beyond their sector and report a length of 0.
+  this->size = EEPROM.length();
+  return this->size >= size;
+}
+
+// Reads and writes copy straight from and to the EEPROM buffer.
+void EEPROMStorage::read(size_t address, void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+#if defined(ARDUINO_ARCH_ESP8266)
+  memcpy(data, EEPROM.getConstDataPtr() + address, length);
+#else
+  EEPROM.readBytes(address, data, length);
+#endif
+}
+
+void EEPROMStorage::write(size_t address, const void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+#if defined(ARDUINO_ARCH_ESP8266)
+  memcpy(EEPROM.getDataPtr() + address, data, length);
+#else
+  EEPROM.writeBytes(address, data, length);
+#endif
+}
+
+uint8_t* EEPROMStorage::data() {
+  return EEPROM.getDataPtr();
+}
+
+bool EEPROMStorage::commit(const StorageRange*, size_t) {
+  // The EEPROM emulation rewrites its whole sector on every commit.
+  return EEPROM.commit();
+}
+
+//
+// Journal Storage
+//
+JournalStorage::JournalStorage(uint32_t firstSector, uint16_t sectorCount) {
+  this->firstSector = firstSector;
+  // Compaction needs somewhere to go while the active sector stays valid.
+  this->sectorCount = sectorCount < 2 ? 2 : sectorCount;
+}
+
+bool JournalStorage::begin(size_t size) {
+  size_t maxSize = JOURNAL_SECTOR_SIZE - sizeof(JournalSectorHeader) -
+                   sizeof(JournalRecordHeader);
+  if (size > maxSize) {
+    return false;
+  }
+
+  this->size = size;
+  image.reset(new uint8_t[size]);
+  memset(image.get(), 0xFF, size);
+
+  replay();
+  return true;
+}
+
+void JournalStorage::read(size_t address, void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+  memcpy(data, image.get() + address, length);
+}
+
+void JournalStorage::write(size_t address, const void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+  memcpy(image.get() + address, data, length);
+}
+
+bool JournalStorage::commit(const StorageRange* ranges, size_t count) {
+  if (!image || count == 0) {
+    return false;
+  }
+
+  size_t needed = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (ranges[i].end <= ranges[i].start || ranges[i].end > size) {
+      return false;
+    }
+    needed +=
+        sizeof(JournalRecordHeader) + align4(ranges[i].end - ranges[i].start);
+  }
+
+  if (writePos + needed > JOURNAL_SECTOR_SIZE) {
+    // The snapshot written by the compaction includes these changes.
+    return compact();
+  }
+
+  uint32_t base = sectorAddress(sector);
+  uint32_t pos = writePos;
+  for (size_t i = 0; i < count; i++) {
+    uint16_t length = ranges[i].end - ranges[i].start;
+
+    JournalRecordHeader record;
+    record.offset = ranges[i].start | (i + 1 < count ? JOURNAL_MORE : 0);
+    record.length = length;
+    record.sequence = sequence + 1;
+    record.crc = crc32(&record, JOURNAL_RECORD_CRC_LENGTH);
+    record.crc = crc32(image.get() + ranges[i].start, length, record.crc);
+
+    if (!flashWrite(base + pos, &record, sizeof(record)) ||
+        !flashWrite(base + pos + sizeof(record),
+                    image.get() + ranges[i].start, length)) {
+      // Whatever made it to flash is garbage now, start over elsewhere.
+      writePos = JOURNAL_SECTOR_SIZE;
+      return compact();
+    }
+    pos += sizeof(record) + align4(length);
+    stats.records++;
+  }
+
+  sequence++;
+  writePos = pos;
+
+  // Leave enough room that the next commit rarely has to compact inline.
+  if (JOURNAL_SECTOR_SIZE - writePos < JOURNAL_SECTOR_SIZE / 4) {
+    compactPending = true;
+  }
+  return true;
+}
+
+void JournalStorage::loop() {
+  if (compactPending) {
+    compact();
+  }
+}
+
+JournalStats JournalStorage::getStats() {
+  stats.sequence = sequence;
+  stats.sector = sector;
+  stats.used = writePos;
+  return stats;
+}
+
+uint32_t JournalStorage::sectorAddress(uint16_t index) {
+  return (firstSector + index) * JOURNAL_SECTOR_SIZE;
+}
+
+bool JournalStorage::readSectorHeader(uint16_t index, uint32_t* seq) {
+  JournalSectorHeader header;
+  if (!ESP.flashRead(sectorAddress(index), (uint32_t*)&header,
+                     sizeof(header))) {
+    return false;
+  }
+
+  if (header.magic != JOURNAL_MAGIC ||
+      header.crc != crc32(&header, sizeof(header) - sizeof(header.crc))) {
+    return false;
+  }
+
+  *seq = header.sequence;
+  return true;
+}
+
+void JournalStorage::replay() {
+  bool found = false;
+  uint32_t newest = 0;
+
+  // Only the sector headers are read to find the active sector.
+  for (uint16_t i = 0; i < sectorCount; i++) {
+    uint32_t seq;
+    if (readSectorHeader(i, &seq) && (!found || seq > newest)) {
+      found = true;
+      newest = seq;
+      sector = i;
+    }
+  }
+
+  if (!found) {
+    // Nothing stored yet, the first commit starts a fresh sector.
+    sector = sectorCount - 1;
+    writePos = JOURNAL_SECTOR_SIZE;
+    sequence = 0;
+    return;
+  }
+
+  uint32_t pos = sizeof(JournalSectorHeader);
+  sequence = newest;
+
+  while (pos + sizeof(JournalRecordHeader) <= JOURNAL_SECTOR_SIZE) {
+    // Verify every record of a commit before applying any of them, a torn
+    // write must not leak into the image.
+    uint32_t end = pos;
+    bool valid = true;
+    bool complete = false;
+    JournalRecordHeader record;
+
+    while (valid && !complete &&
+           end + sizeof(JournalRecordHeader) <= JOURNAL_SECTOR_SIZE &&
+           readRecord(end, &record, &valid)) {
+      if (valid) {
+        end += sizeof(record) + align4(record.length);
+        complete = !(record.offset & JOURNAL_MORE);
+      }
+    }
+
+    if (complete) {
+      applyRecords(pos, end);
+      sequence = record.sequence;
+      pos = end;
+      continue;
+    }
+
+    if (end != pos || !valid) {
+      DebugPrintln(F("Journal record invalid, compacting"));
+      pos = JOURNAL_SECTOR_SIZE;
+      compactPending = true;
+    }
+    break;
+  }
+
+  writePos = pos;
+}
+
+// Reads and verifies the record at pos, returns false on erased flash.
+bool JournalStorage::readRecord(uint32_t pos, void* header, bool* valid) {
+  JournalRecordHeader& record = *(JournalRecordHeader*)header;
+  uint32_t base = sectorAddress(sector);
+  flashRead(base + pos, &record, sizeof(record));
+
+  if (record.offset == 0xFFFF && record.length == 0xFFFF) {
+    return false;
+  }
+
+  uint32_t dataPos = pos + sizeof(record);
+  *valid = record.length > 0 &&
+           dataPos + align4(record.length) <= JOURNAL_SECTOR_SIZE;
+  if (!*valid) {
+    return true;
+  }
+
+  uint8_t chunk[JOURNAL_CHUNK];
+  uint32_t crc = crc32(&record, JOURNAL_RECORD_CRC_LENGTH);
+  for (size_t i = 0; i < record.length; i += JOURNAL_CHUNK) {
+    size_t n = min((size_t)JOURNAL_CHUNK, (size_t)record.length - i);
+    flashRead(base + dataPos + i, chunk, n);
+    crc = crc32(chunk, n, crc);
+  }
+  *valid = crc == record.crc;
+  return true;
+}
+
+void JournalStorage::applyRecords(uint32_t start, uint32_t end) {
+  uint32_t base = sectorAddress(sector);
+  uint8_t chunk[JOURNAL_CHUNK];
+
+  for (uint32_t pos = start; pos < end;) {
+    JournalRecordHeader record;
+    flashRead(base + pos, &record, sizeof(record));
+    uint32_t dataPos = pos + sizeof(record);
+    size_t offset = record.offset & JOURNAL_OFFSET_MASK;
+
+    for (size_t i = 0; i < record.length; i += JOURNAL_CHUNK) {
+      size_t n = min((size_t)JOURNAL_CHUNK, (size_t)record.length - i);
+      size_t address = offset + i;
+      flashRead(base + dataPos + i, chunk, n);
+      // Records written for a larger image are clipped.
+      if (address < size) {
+        memcpy(image.get() + address, chunk, min(n, size - address));
+      }
+    }
+
+    pos = dataPos + align4(record.length);
+  }
+}
+
+bool JournalStorage::compact() {
+  uint16_t next = (sector + 1) % sectorCount;
+  uint32_t base = sectorAddress(next);
+
+  if (!ESP.flashEraseSector(firstSector + next)) {
+    return false;
+  }
+
+  JournalRecordHeader record;
+  record.offset = 0;
+  record.length = size;
+  record.sequence = sequence + 1;
+  record.crc = crc32(&record, JOURNAL_RECORD_CRC_LENGTH);
+  record.crc = crc32(image.get(), size, record.crc);
+
+  JournalSectorHeader header;
+  header.magic = JOURNAL_MAGIC;
+  header.sequence = record.sequence;
+  header.size = size;
+  header.crc = crc32(&header, sizeof(header) - sizeof(header.crc));
+
+  // The header goes last, the sector only becomes active once the snapshot
+  // is fully written.
+  uint32_t pos = sizeof(header);
+  if (!flashWrite(base + pos, &record, sizeof(record)) ||
+      !flashWrite(base + pos + sizeof(record), image.get(), size) ||
+      !flashWrite(base, &header, sizeof(header))) {
+    return false;
+  }
+
+  sector = next;
+  sequence = record.sequence;
+  writePos = pos + sizeof(record) + align4(size);
+  compactPending = false;
+  stats.compactions++;
+  return true;
+}
+
+bool JournalStorage::flashRead(uint32_t address, void* data, size_t length) {
+  uint8_t* ptr = (uint8_t*)data;
+  uint32_t chunk[JOURNAL_CHUNK / 4];
+
+  // Flash reads must be word aligned as well.
+  for (size_t i = 0; i < length; i += JOURNAL_CHUNK) {
+    size_t n = min((size_t)JOURNAL_CHUNK, length - i);
+    if (!ESP.flashRead(address + i, chunk, align4(n))) {
+      return false;
+    }
+    memcpy(ptr + i, chunk, n);
+  }
+  return true;
+}
+
+bool JournalStorage::flashWrite(uint32_t address,
+                                const void* data,
+                                size_t length) {
+  const uint8_t* ptr = (const uint8_t*)data;
+  uint32_t chunk[JOURNAL_CHUNK / 4];
+
+  // Flash writes must be word aligned, stage the data through an aligned
+  // buffer and pad the tail with erased bytes.
+  for (size_t i = 0; i < length; i += JOURNAL_CHUNK) {
+    size_t n = min((size_t)JOURNAL_CHUNK, length - i);
+    memset(chunk, 0xFF, sizeof(chunk));
+    memcpy(chunk, ptr + i, n);
+    if (!ESP.flashWrite(address + i, chunk, align4(n))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// Slot Storage
+//
+SlotStorage::SlotStorage(uint32_t firstSector, uint16_t slotSectors) {
+  this->firstSector = firstSector;
+  this->slotSectors = slotSectors < 1 ? 1 : slotSectors;
+}
+
+bool SlotStorage::begin(size_t size) {
+  if (sizeof(SlotHeader) + size > slotSectors * JOURNAL_SECTOR_SIZE) {
+    return false;
+  }
+
+  this->size = size;
+  image.reset(new uint8_t[size]);
+  memset(image.get(), 0xFF, size);
+
+  SlotHeader headers[2];
+  bool valid[2];
+  for (uint8_t i = 0; i < 2; i++) {
+    valid[i] = readSlotHeader(i, &headers[i]);
+  }
+
+  // Newest first, by headers alone. The wrapping difference keeps the order
+  // right when the generation overflows.
+  uint8_t newest = 0;
+  if (valid[0] && valid[1]) {
+    newest = (int32_t)(headers[1].generation - headers[0].generation) > 0;
+  } else if (valid[1]) {
+    newest = 1;
+  }
+
+  for (uint8_t n = 0; n < 2; n++) {
+    uint8_t i = n == 0 ? newest : !newest;
+    if (valid[i] && load(i, &headers[i])) {
+      slot = i;
+      generation = headers[i].generation;
+      stats.fallback = n > 0;
+      return true;
+    }
+  }
+
+  // Nothing stored yet, the first commit goes to slot 0.
+  memset(image.get(), 0xFF, size);
+  slot = 1;
+  generation = 0;
+  return true;
+}
+
+void SlotStorage::read(size_t address, void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+  memcpy(data, image.get() + address, length);
+}
+
+void SlotStorage::write(size_t address, const void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+  memcpy(image.get() + address, data, length);
+}
+
+bool SlotStorage::commit(const StorageRange*, size_t) {
+  if (!image) {
+    return false;
+  }
+
+  // The inactive slot gets the whole image, whatever the ranges.
+  uint8_t next = !slot;
+  for (uint16_t i = 0; i < slotSectors; i++) {
+    if (!ESP.flashEraseSector(firstSector + next * slotSectors + i)) {
+      return false;
+    }
+  }
+
+  SlotHeader header;
+  header.magic = SLOT_MAGIC;
+  header.generation = generation + 1;
+  header.size = size;
+  header.dataCrc = crc32(image.get(), size);
+  header.crc = crc32(&header, sizeof(header) - sizeof(header.crc));
+
+  // The header goes last, the slot only becomes valid once the image is
+  // fully written.
+  uint32_t base = slotAddress(next);
+  uint32_t chunk[JOURNAL_CHUNK / 4];
+  for (size_t i = 0; i < size; i += JOURNAL_CHUNK) {
+    size_t n = min((size_t)JOURNAL_CHUNK, size - i);
+    memset(chunk, 0xFF, sizeof(chunk));
+    memcpy(chunk, image.get() + i, n);
+    if (!ESP.flashWrite(base + sizeof(header) + i, chunk, align4(n))) {
+      return false;
+    }
+  }
+  if (!ESP.flashWrite(base, (uint32_t*)&header, sizeof(header))) {
+    return false;
+  }
+
+  slot = next;
+  generation = header.generation;
+  stats.commits++;
+  return true;
+}
+
+SlotStats SlotStorage::getStats() {
+  stats.generation = generation;
+  stats.slot = slot;
+  return stats;
+}
+
+uint32_t SlotStorage::slotAddress(uint8_t index) {
+  return (firstSector + index * slotSectors) * JOURNAL_SECTOR_SIZE;
+}
+
+bool SlotStorage::readSlotHeader(uint8_t index, void* data) {
+  SlotHeader& header = *(SlotHeader*)data;
+  if (!ESP.flashRead(slotAddress(index), (uint32_t*)&header,
+                     sizeof(header))) {
+    return false;
+  }
+
+  return header.magic == SLOT_MAGIC &&
+         header.crc == crc32(&header, sizeof(header) - sizeof(header.crc));
+}
+
+// Loads the slot into the image, checking its CRC on the way.
+bool SlotStorage::load(uint8_t index, const void* data) {
+  const SlotHeader& header = *(const SlotHeader*)data;
+  uint32_t base = slotAddress(index) + sizeof(SlotHeader);
+  uint32_t chunk[JOURNAL_CHUNK / 4];
+  uint32_t crc = 0;
+
+  // A slot written for a smaller image must still fit the slot sectors.
+  if (sizeof(SlotHeader) + header.size > slotSectors * JOURNAL_SECTOR_SIZE) {
+    return false;
+  }
+
+  for (size_t i = 0; i < header.size; i += JOURNAL_CHUNK) {
+    size_t n = min((size_t)JOURNAL_CHUNK, (size_t)header.size - i);
+    if (!ESP.flashRead(base + i, chunk, align4(n))) {
+      return false;
+    }
+    crc = crc32(chunk, n, crc);
+    // Slots written for a larger image are clipped.
+    if (i < size) {
+      memcpy(image.get() + i, chunk, min(n, size - i));
+    }
+  }
+
+  if (crc != header.dataCrc) {
+    DebugPrintln(F("Config slot CRC mismatch"));
+    memset(image.get(), 0xFF, size);
+    return false;
+  }
+  return true;
+}
+
+//
+// File Storage
+//
+FileStorage::FileStorage(fs::FS& fs, const char* path) : fs(fs), path(path) {}
+
+bool FileStorage::begin(size_t size) {
+  this->size = size;
+  image.reset(new uint8_t[size]);
+  // Whatever the file does not hold reads as erased.
+  memset(image.get(), 0xFF, size);
+
+  File f = fs.open(path, "r");
+  if (f) {
+    size_t stored = f.size();
+    f.read(image.get(), min(stored, size));
+    complete = stored == size;
+    f.close();
+  }
+  return true;
+}
+
+void FileStorage::read(size_t address, void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+  memcpy(data, image.get() + address, length);
+}
+
+void FileStorage::write(size_t address, const void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+  memcpy(image.get() + address, data, length);
+}
+
+bool FileStorage::commit(const StorageRange* ranges, size_t count) {
+  if (!image) {
+    return false;
+  }
+
+  // A missing or short file is written whole, then ranges in place.
+  File f = fs.open(path, complete ? "r+" : "w");
+  if (!f) {
+    return false;
+  }
+
+  bool ok = true;
+  if (!complete || ranges == NULL) {
+    ok = f.write(image.get(), size) == size;
+  } else {
+    for (size_t i = 0; i < count && ok; i++) {
+      size_t length = ranges[i].end - ranges[i].start;
+      ok = f.seek(ranges[i].start) &&
+           f.write(image.get() + ranges[i].start, length) == length;
+    }
+  }
+  f.close();
+
+  complete = complete || ok;
+  return ok;
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+//
+// NVS Storage
+//
+NVSStorage::NVSStorage(const char* name, const char* key)
+    : name(name), key(key) {}
+
+NVSStorage::~NVSStorage() {
+  if (opened) {
+    nvs_close(handle);
+  }
+}
+
+bool NVSStorage::begin(size_t size) {
+  this->size = size;
+  image.reset(new uint8_t[size]);
+  memset(image.get(), 0xFF, size);
+
+  if (!opened) {
+    opened = nvs_open(name, NVS_READWRITE, &handle) == ESP_OK;
+  }
+  if (!opened) {
+    return false;
+  }
+
+  // A blob of another size is from another layout, the start is cold.
+  size_t stored = 0;
+  if (nvs_get_blob(handle, key, NULL, &stored) == ESP_OK && stored == size) {
+    nvs_get_blob(handle, key, image.get(), &stored);
+  }
+  return true;
+}
+
+void NVSStorage::read(size_t address, void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+  memcpy(data, image.get() + address, length);
+}
+
+void NVSStorage::write(size_t address, const void* data, size_t length) {
+  if (address + length > size) {
+    return;
+  }
+  memcpy(image.get() + address, data, length);
+}
+
+bool NVSStorage::commit(const StorageRange*, size_t) {
+  if (!opened) {
+    return false;
+  }
+  return nvs_set_blob(handle, key, image.get(), size) == ESP_OK &&
+         nvs_commit(handle) == ESP_OK;
+}
+#endif
@@ -0,0 +1,232 @@
+#ifndef __CONFIGSTORAGE_H__
+#define __CONFIGSTORAGE_H__
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <FS.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <nvs.h>
+#endif
+
+#include <memory>
+
+// Maximum number of separate byte ranges tracked for a single commit.
+#define STORAGE_MAX_RANGES 4
+
+/**
+ * Storage Range
+ */
+struct StorageRange {
+  size_t start;
+  size_t end;
+};
+
+/**
+ * Config Storage
+ *
+ * Persists the ConfigManager image: the magic bytes, WiFi credentials and
+ * config struct, laid out from address 0.
+ */
+class ConfigStorage {
+ public:
+  virtual ~ConfigStorage() {}
+
+  virtual bool begin(size_t size) = 0;
+  virtual void read(size_t address, void* data, size_t length) = 0;
+  virtual void write(size_t address, const void* data, size_t length) = 0;
+  // Persists pending writes. The ranges are sorted and hold every byte
+  // that changed.
+  virtual bool commit(const StorageRange* ranges, size_t count) = 0;
+  virtual void loop() {}
+  // The image in RAM, for backends that keep one, NULL otherwise. Writes
+  // through it are persisted by the next commit.
+  virtual uint8_t* data() { return NULL; }
+};
+
+/**
+ * EEPROM Storage
+ */
+class EEPROMStorage : public ConfigStorage {
+ public:
+  bool begin(size_t size);
+  void read(size_t address, void* data, size_t length);
+  void write(size_t address, const void* data, size_t length);
+  bool commit(const StorageRange* ranges, size_t count);
+  uint8_t* data();
+
+ private:
+  size_t size = 0;
+};
+
+/**
+ * Journal Stats
+ */
+struct JournalStats {
+  uint32_t sequence;     // sequence number of the last record
+  uint32_t records;      // records appended since boot
+  uint32_t compactions;  // sectors rewritten since boot
+  uint16_t sector;       // active flash sector
+  uint16_t used;         // bytes used in the active sector
+};
+
+/**
+ * Journal Storage
+ *
+ * Append-only storage spread over a range of raw flash sectors. Each commit
+ * appends sequence numbered, CRC protected records holding only the changed
+ * byte ranges, applied together or not at all. When a sector fills up, the
+ * image is compacted into the next sector, so erases are spread evenly over
+ * all of them.
+ *
+ * The sectors must not overlap the sketch, filesystem or EEPROM sector.
+ */
+class JournalStorage : public ConfigStorage {
+ public:
+  JournalStorage(uint32_t firstSector, uint16_t sectorCount);
+
+  bool begin(size_t size);
+  void read(size_t address, void* data, size_t length);
+  void write(size_t address, const void* data, size_t length);
+  bool commit(const StorageRange* ranges, size_t count);
+  void loop();
+  uint8_t* data() { return image.get(); }
+
+  JournalStats getStats();
+
+ private:
+  uint32_t firstSector;
+  uint16_t sectorCount;
+
+  std::unique_ptr<uint8_t[]> image;
+  size_t size = 0;
+
+  uint16_t sector = 0;
+  uint32_t writePos = 0;
+  uint32_t sequence = 0;
+  bool compactPending = false;
+  JournalStats stats = {0, 0, 0, 0, 0};
+
+  uint32_t sectorAddress(uint16_t index);
+  bool readSectorHeader(uint16_t index, uint32_t* seq);
+  void replay();
+  bool readRecord(uint32_t pos, void* record, bool* valid);
+  void applyRecords(uint32_t start, uint32_t end);
+  bool compact();
+  bool flashRead(uint32_t address, void* data, size_t length);
+  bool flashWrite(uint32_t address, const void* data, size_t length);
+};
+
+/**
+ * Slot Stats
+ */
+struct SlotStats {
+  uint32_t generation;  // generation of the active slot
+  uint32_t commits;     // slots written since boot
+  uint8_t slot;         // active slot, 0 or 1
+  bool fallback;        // the newest slot was invalid, the older one loaded
+};
+
+/**
+ * Slot Storage
+ *
+ * Two alternating copies of the image in raw flash sectors, each with a
+ * generation number and CRC32. A commit rewrites the inactive slot and
+ * writes its header last, so a torn write leaves the previous slot intact.
+ * At boot the newest slot is picked from the headers and its CRC checked
+ * while it is loaded.
+ *
+ * Each slot is slotSectors long, slot 0 starts at firstSector and slot 1
+ * right after it. The stride does not depend on the image size, so a
+ * firmware with a larger config still finds both copies; begin() fails when
+ * the image does not fit a slot. The 2 * slotSectors sectors must not
+ * overlap the sketch, filesystem or EEPROM sector.
+ */
+class SlotStorage : public ConfigStorage {
+ public:
+  SlotStorage(uint32_t firstSector, uint16_t slotSectors = 1);
+
+  bool begin(size_t size);
+  void read(size_t address, void* data, size_t length);
+  void write(size_t address, const void* data, size_t length);
+  bool commit(const StorageRange* ranges, size_t count);
+  uint8_t* data() { return image.get(); }
+
+  SlotStats getStats();
+
+ private:
+  uint32_t firstSector;
+  uint16_t slotSectors;
+
+  std::unique_ptr<uint8_t[]> image;
+  size_t size = 0;
+
+  uint8_t slot = 0;
+  uint32_t generation = 0;
+  SlotStats stats = {0, 0, 0, false};
+
+  uint32_t slotAddress(uint8_t index);
+  bool readSlotHeader(uint8_t index, void* header);
+  bool load(uint8_t index, const void* header);
+};
+
+/**
+ * File Storage
+ *
+ * The image in a file, on LittleFS or any other mounted filesystem. A
+ * commit rewrites the changed ranges in place. LittleFS applies a file's
+ * changes atomically when it is closed, SPIFFS does not.
+ *
+ * The filesystem must be mounted before begin().
+ */
+class FileStorage : public ConfigStorage {
+ public:
+  FileStorage(fs::FS& fs, const char* path);
+
+  bool begin(size_t size);
+  void read(size_t address, void* data, size_t length);
+  void write(size_t address, const void* data, size_t length);
+  bool commit(const StorageRange* ranges, size_t count);
+  uint8_t* data() { return image.get(); }
+
+ private:
+  fs::FS& fs;
+  const char* path;
+
+  std::unique_ptr<uint8_t[]> image;
+  size_t size = 0;
+  // The file holds the whole image, ranges can be written in place.
+  bool complete = false;
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+/**
+ * NVS Storage
+ *
+ * The image as a single blob in the ESP32 NVS partition. NVS spreads its
+ * writes over the partition and checks every entry, a commit rewrites the
+ * whole blob. Blobs are limited to about 4000 bytes before ESP-IDF 4.
+ */
+class NVSStorage : public ConfigStorage {
+ public:
+  NVSStorage(const char* name = "config", const char* key = "image");
+  ~NVSStorage();
+
+  bool begin(size_t size);
+  void read(size_t address, void* data, size_t length);
+  void write(size_t address, const void* data, size_t length);
+  bool commit(const StorageRange* ranges, size_t count);
+  uint8_t* data() { return image.get(); }
+
+ private:
+  const char* name;
+  const char* key;
+  uint32_t handle = 0;
+  bool opened = false;
+
+  std::unique_ptr<uint8_t[]> image;
+  size_t size = 0;
+};
+#endif
+
+#endif /* __CONFIGSTORAGE_H__ */
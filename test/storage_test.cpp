@@ -0,0 +1,404 @@
+// Crash consistency tests for the raw flash storage backends.
+//
+// Build and run with `make test`. Each case writes through a backend,
+// corrupts or cuts power to the emulated flash, then begins a fresh
+// instance on the same sectors, the way the device would after a reboot,
+// and checks what it recovered.
+
+#include <ConfigManager.h>
+#include <stdio.h>
+
+static const uint32_t SECTOR_SIZE = 4096;
+// Journal record header, as laid out by ConfigStorage.cpp.
+static const uint32_t JOURNAL_RECORD_HEADER = 12;
+
+static int failures = 0;
+
+#define CHECK(cond)                                          \
+  do {                                                       \
+    if (!(cond)) {                                           \
+      printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                            \
+    }                                                        \
+  } while (0)
+
+// Clears every bit of the flash word at address, the way a bit flip or a
+// half programmed word would leave it.
+static void corruptWord(uint32_t address) {
+  uint32_t zero = 0;
+  ESP.flashWrite(address, &zero, sizeof(zero));
+}
+
+static void eraseSectors(uint32_t first, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    ESP.flashEraseSector(first + i);
+  }
+}
+
+template <typename S>
+static bool commitRange(S& storage,
+                        const uint8_t* image,
+                        size_t start,
+                        size_t end) {
+  storage.write(start, image + start, end - start);
+  StorageRange range = {start, end};
+  return storage.commit(&range, 1);
+}
+
+template <typename S>
+static bool recovered(S& storage, const uint8_t* image, size_t size) {
+  uint8_t buffer[8192];
+  storage.read(0, buffer, size);
+  return memcmp(buffer, image, size) == 0;
+}
+
+//
+// Journal Storage
+//
+static const uint32_t JOURNAL_FIRST = 100;
+static const uint16_t JOURNAL_SECTORS = 3;
+static const size_t JOURNAL_SIZE = 256;
+
+static uint32_t journalAddress(JournalStorage& journal, uint32_t pos) {
+  return (JOURNAL_FIRST + journal.getStats().sector) * SECTOR_SIZE + pos;
+}
+
+// Every commit is replayed on begin, in order.
+static void testJournalReplay() {
+  eraseSectors(JOURNAL_FIRST, JOURNAL_SECTORS);
+  uint8_t image[JOURNAL_SIZE];
+  memset(image, 0xA5, sizeof(image));
+
+  {
+    JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+    CHECK(journal.begin(JOURNAL_SIZE));
+    CHECK(commitRange(journal, image, 0, JOURNAL_SIZE));
+    for (uint8_t i = 1; i <= 20; i++) {
+      image[i * 8] = i;
+      image[200 + i] = i;
+      journal.write(i * 8, image + i * 8, 1);
+      journal.write(200 + i, image + 200 + i, 1);
+      StorageRange ranges[2] = {{i * 8u, i * 8u + 1}, {200u + i, 201u + i}};
+      CHECK(journal.commit(ranges, 2));
+    }
+  }
+
+  JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+  CHECK(journal.begin(JOURNAL_SIZE));
+  CHECK(recovered(journal, image, JOURNAL_SIZE));
+  CHECK(journal.getStats().sequence == 21);
+}
+
+// A commit whose second record is corrupt is dropped as a whole, the first
+// record must not leak into the image.
+static void testJournalCorruptRecord() {
+  eraseSectors(JOURNAL_FIRST, JOURNAL_SECTORS);
+  uint8_t image[JOURNAL_SIZE];
+  memset(image, 0xA5, sizeof(image));
+  uint8_t before[JOURNAL_SIZE];
+  uint32_t recordPos;
+
+  {
+    JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+    CHECK(journal.begin(JOURNAL_SIZE));
+    CHECK(commitRange(journal, image, 0, JOURNAL_SIZE));
+    memcpy(before, image, sizeof(before));
+
+    recordPos = journal.getStats().used;
+    memset(image + 16, 0x11, 4);
+    memset(image + 64, 0x22, 4);
+    journal.write(16, image + 16, 4);
+    journal.write(64, image + 64, 4);
+    StorageRange ranges[2] = {{16, 20}, {64, 68}};
+    CHECK(journal.commit(ranges, 2));
+
+    // The second record's data, mid-commit.
+    corruptWord(journalAddress(journal, recordPos + 2 * JOURNAL_RECORD_HEADER +
+                                            4));
+  }
+
+  {
+    JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+    CHECK(journal.begin(JOURNAL_SIZE));
+    CHECK(recovered(journal, before, JOURNAL_SIZE));
+
+    // The garbage is compacted away, later commits land after it.
+    uint16_t sector = journal.getStats().sector;
+    journal.loop();
+    CHECK(journal.getStats().sector == (sector + 1) % JOURNAL_SECTORS);
+    memcpy(image, before, sizeof(image));
+    image[100] = 0x33;
+    CHECK(commitRange(journal, image, 100, 101));
+  }
+
+  JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+  CHECK(journal.begin(JOURNAL_SIZE));
+  CHECK(recovered(journal, image, JOURNAL_SIZE));
+}
+
+// Power is cut after a record header made it to flash but not its data.
+static void testJournalTornRecord() {
+  eraseSectors(JOURNAL_FIRST, JOURNAL_SECTORS);
+  uint8_t image[JOURNAL_SIZE];
+  memset(image, 0xA5, sizeof(image));
+  uint8_t before[JOURNAL_SIZE];
+
+  {
+    JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+    CHECK(journal.begin(JOURNAL_SIZE));
+    CHECK(commitRange(journal, image, 0, JOURNAL_SIZE));
+    image[8] = 0x44;
+    CHECK(commitRange(journal, image, 8, 9));
+    memcpy(before, image, sizeof(before));
+
+    memset(image + 32, 0x55, 32);
+    ESP.flashOpsLeft = 1;
+    CHECK(!commitRange(journal, image, 32, 64));
+    ESP.flashOpsLeft = -1;
+  }
+
+  JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+  CHECK(journal.begin(JOURNAL_SIZE));
+  CHECK(recovered(journal, before, JOURNAL_SIZE));
+  CHECK(journal.getStats().sequence == 2);
+}
+
+// A full sector is compacted into the next one, which wraps around the
+// range and survives a reboot.
+static void testJournalCompaction() {
+  eraseSectors(JOURNAL_FIRST, JOURNAL_SECTORS);
+  uint8_t image[JOURNAL_SIZE];
+  memset(image, 0xA5, sizeof(image));
+
+  JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+  CHECK(journal.begin(JOURNAL_SIZE));
+  CHECK(commitRange(journal, image, 0, JOURNAL_SIZE));
+  // The first commit already wrote a snapshot.
+  JournalStats start = journal.getStats();
+
+  // Enough commits to fill more sectors than the range holds.
+  for (uint32_t i = 0; i < 2000; i++) {
+    uint32_t value = i;
+    memcpy(image + (i % 60) * 4, &value, sizeof(value));
+    CHECK(commitRange(journal, image, (i % 60) * 4, (i % 60) * 4 + 4));
+    if (i % 50 == 0) {
+      journal.loop();
+    }
+  }
+  JournalStats stats = journal.getStats();
+  uint32_t compactions = stats.compactions - start.compactions;
+  CHECK(compactions > JOURNAL_SECTORS);
+  CHECK(stats.sector == (start.sector + compactions) % JOURNAL_SECTORS);
+
+  JournalStorage rebooted(JOURNAL_FIRST, JOURNAL_SECTORS);
+  CHECK(rebooted.begin(JOURNAL_SIZE));
+  CHECK(recovered(rebooted, image, JOURNAL_SIZE));
+  CHECK(rebooted.getStats().sector == stats.sector);
+  CHECK(rebooted.getStats().sequence == stats.sequence);
+}
+
+// Power is cut while compacting, before the new sector's header is written.
+// The old sector stays active with everything committed to it.
+static void testJournalTornCompaction() {
+  eraseSectors(JOURNAL_FIRST, JOURNAL_SECTORS);
+  uint8_t image[JOURNAL_SIZE];
+  memset(image, 0xA5, sizeof(image));
+  uint16_t sector;
+
+  {
+    JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+    CHECK(journal.begin(JOURNAL_SIZE));
+    CHECK(commitRange(journal, image, 0, JOURNAL_SIZE));
+    sector = journal.getStats().sector;
+    uint32_t compactions = journal.getStats().compactions;
+
+    // Fill the sector until loop() wants to compact it.
+    for (uint32_t i = 0; journal.getStats().used < SECTOR_SIZE * 3 / 4; i++) {
+      image[i % JOURNAL_SIZE] = (uint8_t)i;
+      CHECK(commitRange(journal, image, i % JOURNAL_SIZE,
+                        i % JOURNAL_SIZE + 1));
+    }
+    CHECK(journal.getStats().sector == sector);
+
+    // The erase, the snapshot's record header and its data in four chunks
+    // make it, the sector header does not.
+    ESP.flashOpsLeft = 6;
+    journal.loop();
+    ESP.flashOpsLeft = -1;
+    CHECK(journal.getStats().compactions == compactions);
+  }
+
+  {
+    JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+    CHECK(journal.begin(JOURNAL_SIZE));
+    CHECK(recovered(journal, image, JOURNAL_SIZE));
+    CHECK(journal.getStats().sector == sector);
+
+    // The half written sector is erased again by the next compaction.
+    image[1] = 0x77;
+    journal.write(1, image + 1, 1);
+    CHECK(journal.getStats().compactions == 0);
+    while (journal.getStats().compactions == 0) {
+      CHECK(commitRange(journal, image, 1, 2));
+      journal.loop();
+    }
+  }
+
+  JournalStorage journal(JOURNAL_FIRST, JOURNAL_SECTORS);
+  CHECK(journal.begin(JOURNAL_SIZE));
+  CHECK(recovered(journal, image, JOURNAL_SIZE));
+  CHECK(journal.getStats().sector == (sector + 1) % JOURNAL_SECTORS);
+}
+
+//
+// Slot Storage
+//
+static const uint32_t SLOT_FIRST = 200;
+static const uint16_t SLOT_SECTORS = 2;
+static const size_t SLOT_SIZE = 5000;
+// Slot header, as laid out by ConfigStorage.cpp.
+static const uint32_t SLOT_HEADER = 20;
+
+static uint32_t slotAddress(uint8_t slot) {
+  return (SLOT_FIRST + slot * SLOT_SECTORS) * SECTOR_SIZE;
+}
+
+// Two commits land in alternating slots, the newest is loaded on begin.
+static void testSlotReload() {
+  eraseSectors(SLOT_FIRST, 2 * SLOT_SECTORS);
+  static uint8_t image[SLOT_SIZE];
+  memset(image, 0xA5, sizeof(image));
+
+  {
+    SlotStorage slots(SLOT_FIRST, SLOT_SECTORS);
+    CHECK(slots.begin(SLOT_SIZE));
+    CHECK(commitRange(slots, image, 0, SLOT_SIZE));
+    CHECK(slots.getStats().slot == 0);
+    image[4500] = 0x11;
+    CHECK(commitRange(slots, image, 4500, 4501));
+    CHECK(slots.getStats().slot == 1);
+  }
+
+  SlotStorage slots(SLOT_FIRST, SLOT_SECTORS);
+  CHECK(slots.begin(SLOT_SIZE));
+  CHECK(recovered(slots, image, SLOT_SIZE));
+  SlotStats stats = slots.getStats();
+  CHECK(stats.slot == 1);
+  CHECK(stats.generation == 2);
+  CHECK(!stats.fallback);
+}
+
+// A bad CRC in the newest slot falls back to the older generation.
+static void testSlotCrcFallback() {
+  eraseSectors(SLOT_FIRST, 2 * SLOT_SECTORS);
+  static uint8_t image[SLOT_SIZE];
+  static uint8_t before[SLOT_SIZE];
+  memset(image, 0xA5, sizeof(image));
+
+  {
+    SlotStorage slots(SLOT_FIRST, SLOT_SECTORS);
+    CHECK(slots.begin(SLOT_SIZE));
+    CHECK(commitRange(slots, image, 0, SLOT_SIZE));
+    memcpy(before, image, sizeof(before));
+    memset(image + 4200, 0x22, 100);
+    CHECK(commitRange(slots, image, 4200, 4300));
+  }
+
+  // In the second sector of slot 1, past the header.
+  corruptWord(slotAddress(1) + SLOT_HEADER + 4200);
+
+  {
+    SlotStorage slots(SLOT_FIRST, SLOT_SECTORS);
+    CHECK(slots.begin(SLOT_SIZE));
+    CHECK(recovered(slots, before, SLOT_SIZE));
+    SlotStats stats = slots.getStats();
+    CHECK(stats.slot == 0);
+    CHECK(stats.generation == 1);
+    CHECK(stats.fallback);
+
+    // The next commit overwrites the corrupt slot.
+    memcpy(image, before, sizeof(image));
+    image[10] = 0x33;
+    CHECK(commitRange(slots, image, 10, 11));
+    CHECK(slots.getStats().slot == 1);
+  }
+
+  SlotStorage slots(SLOT_FIRST, SLOT_SECTORS);
+  CHECK(slots.begin(SLOT_SIZE));
+  CHECK(recovered(slots, image, SLOT_SIZE));
+  CHECK(slots.getStats().generation == 2);
+  CHECK(!slots.getStats().fallback);
+}
+
+// Power is cut while the inactive slot is written, before its header.
+static void testSlotTornWrite() {
+  eraseSectors(SLOT_FIRST, 2 * SLOT_SECTORS);
+  static uint8_t image[SLOT_SIZE];
+  static uint8_t before[SLOT_SIZE];
+  memset(image, 0xA5, sizeof(image));
+
+  {
+    SlotStorage slots(SLOT_FIRST, SLOT_SECTORS);
+    CHECK(slots.begin(SLOT_SIZE));
+    CHECK(commitRange(slots, image, 0, SLOT_SIZE));
+    memcpy(before, image, sizeof(before));
+
+    // Both erases and part of the image make it.
+    memset(image, 0x44, 64);
+    ESP.flashOpsLeft = 10;
+    CHECK(!commitRange(slots, image, 0, 64));
+    ESP.flashOpsLeft = -1;
+  }
+
+  SlotStorage slots(SLOT_FIRST, SLOT_SECTORS);
+  CHECK(slots.begin(SLOT_SIZE));
+  CHECK(recovered(slots, before, SLOT_SIZE));
+  CHECK(slots.getStats().generation == 1);
+  CHECK(!slots.getStats().fallback);
+}
+
+// The slots stay put when the image grows, a larger config still finds the
+// copies written for the smaller one.
+static void testSlotResize() {
+  eraseSectors(SLOT_FIRST, 2 * SLOT_SECTORS);
+  static uint8_t image[SLOT_SIZE];
+  memset(image, 0xA5, sizeof(image));
+
+  {
+    SlotStorage slots(SLOT_FIRST, SLOT_SECTORS);
+    CHECK(slots.begin(1000));
+    CHECK(commitRange(slots, image, 0, 1000));
+    image[20] = 0x55;
+    CHECK(commitRange(slots, image, 20, 21));
+    CHECK(slots.getStats().slot == 1);
+  }
+
+  SlotStorage slots(SLOT_FIRST, SLOT_SECTORS);
+  CHECK(slots.begin(SLOT_SIZE));
+  CHECK(recovered(slots, image, 1000));
+  CHECK(slots.getStats().slot == 1);
+  CHECK(slots.getStats().generation == 2);
+
+  // An image that leaves no room for the slot header is refused.
+  SlotStorage full(SLOT_FIRST, SLOT_SECTORS);
+  CHECK(!full.begin(SLOT_SECTORS * SECTOR_SIZE));
+}
+
+int main() {
+  testJournalReplay();
+  testJournalCorruptRecord();
+  testJournalTornRecord();
+  testJournalCompaction();
+  testJournalTornCompaction();
+  testSlotReload();
+  testSlotCrcFallback();
+  testSlotTornWrite();
+  testSlotResize();
+
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All storage tests passed\n");
+  return 0;
+}
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Turns a data directory into a PROGMEM asset table for ConfigManager.
+
+Every file is stored as is and gzip compressed, when that makes it smaller.
+Pass the generated table to ConfigManager::setAssets to serve the files
+without a filesystem.
+
+    python3 tools/assets.py data src/ConfigAssets.h [--gzip-only]
+"""
+
+import argparse
+import gzip
+import os
+import re
+import sys
+
+MIME_TYPES = {
+    ".css": "text/css",
+    ".gif": "image/gif",
+    ".htm": "text/html",
+    ".html": "text/html",
+    ".ico": "image/x-icon",
+    ".jpg": "image/jpeg",
+    ".js": "application/javascript",
+    ".json": "application/json",
+    ".png": "image/png",
+    ".svg": "image/svg+xml",
+    ".txt": "text/plain",
+}
+
+
+def fnv1a(data):
+    h = 0x811C9DC5
+    for b in bytearray(data):
+        h = ((h ^ b) * 0x01000193) & 0xFFFFFFFF
+    return h
+
+
+def symbol(path, index):
+    return "asset%d_%s" % (index, re.sub(r"[^A-Za-z0-9]", "_", path.strip("/")))
+
+
+def c_bytes(data):
+    data = bytearray(data)
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("  " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    return "\n".join(lines)
+
+
+def collect(root):
+    files = []
+    for directory, _, names in os.walk(root):
+        for name in sorted(names):
+            full = os.path.join(directory, name)
+            path = "/" + os.path.relpath(full, root).replace(os.sep, "/")
+            if path.endswith(".gz"):
+                continue
+            with open(full, "rb") as f:
+                files.append((path, f.read()))
+    return sorted(files)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("data", help="directory holding the assets")
+    parser.add_argument("output", help="header to write")
+    parser.add_argument("--gzip-only", action="store_true",
+                        help="drop the uncompressed copy of compressible files")
+    args = parser.parse_args()
+
+    out = []
+    entries = []
+    for index, (path, data) in enumerate(collect(args.data)):
+        name = symbol(path, index)
+        mime = MIME_TYPES.get(os.path.splitext(path)[1].lower(),
+                              "application/octet-stream")
+        packed = gzip.compress(data, 9, mtime=0)
+
+        out.append('static const char %s_path[] PROGMEM = "%s";' % (name, path))
+        out.append('static const char %s_mime[] PROGMEM = "%s";' % (name, mime))
+        out.append('static const char %s_etag[] PROGMEM = "\\"%08x\\"";'
+                   % (name, fnv1a(data)))
+
+        variants = []
+        if len(packed) < len(data):
+            variants.append(("gz", packed, "true"))
+            if not args.gzip_only:
+                variants.append(("raw", data, "false"))
+        else:
+            variants.append(("raw", data, "false"))
+
+        for suffix, content, gzipped in variants:
+            out.append("static const uint8_t %s_%s[] PROGMEM = {\n%s\n};"
+                       % (name, suffix, c_bytes(content)))
+            entries.append("  {%s_path, %s_mime, %s_etag, %s_%s, %d, %s},"
+                           % (name, name, name, name, suffix, len(content),
+                              gzipped))
+        out.append("")
+
+    with open(args.output, "w") as f:
+        f.write("// Generated by tools/assets.py from %s, do not edit.\n\n"
+                % os.path.basename(os.path.normpath(args.data)))
+        f.write("#ifndef __CONFIG_ASSETS_H__\n#define __CONFIG_ASSETS_H__\n\n")
+        f.write('#include "ConfigManager.h"\n\n')
+        f.write("\n".join(out))
+        f.write("\nstatic const ConfigAsset configAssets[] PROGMEM = {\n")
+        f.write("\n".join(entries))
+        f.write("\n};\n\nstatic const size_t configAssetCount =\n"
+                "    sizeof(configAssets) / sizeof(configAssets[0]);\n\n")
+        f.write("#endif /* __CONFIG_ASSETS_H__ */\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())